@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+#include "matrix.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#define TILE 64  /* tile size of MULT_BLOCKED, three tiles fit into the L2 cache */
+#define MR 6     /* rows of the micro-kernel */
+#define NR 16    /* columns of the micro-kernel, two AVX2 registers */
+#define MC 96    /* rows of a block of a, stays in the L2 cache */
+#define KC 256   /* depth of a block, a panel of KC x NR of b stays in the L1 cache */
+#define NC 1024  /* columns of a packed block of b */
+
+typedef bool (*MultFunction)(const void *a, const void *b, void *c, size_t m, size_t n, size_t k);
+
+const char *MultMethodNames[MULT_METHOD_COUNT] = {
+	"naive",
+	"reordered",
+	"blocked",
+	"simd",
+	"parallel"
+};
+
+static size_t min_size(size_t a, size_t b) {
+	return a < b ? a : b;
+}
+
+Matrix *create_matrix(MatrixType type, size_t rows, size_t cols) {
+	/* Both types have 4 bytes, the size is rounded up for aligned_alloc */
+	size_t size = (rows * cols * 4 + 63) & ~(size_t) 63;
+	Matrix *matrix = malloc(sizeof(Matrix));
+	if (matrix == NULL) {
+		return NULL;
+	}
+	matrix->type = type;
+	matrix->rows = rows;
+	matrix->cols = cols;
+	matrix->data = aligned_alloc(64, size ? size : 64);
+	if (matrix->data == NULL) {
+		free(matrix);
+		return NULL;
+	}
+	memset(matrix->data, 0, size);
+	return matrix;
+}
+
+void delete_matrix(Matrix *matrix) {
+	if (matrix == NULL) {
+		return;
+	}
+	free(matrix->data);
+	free(matrix);
+}
+
+/*
+ * The scalar kernels are the same for both types. a is m x k, b is k x n
+ * and c is m x n.
+ */
+#define DEFINE_SCALAR_KERNELS(T, NAME) \
+static bool naive_##NAME(const void *av, const void *bv, void *cv, size_t m, size_t n, size_t k) { \
+	const T *restrict a = av, *restrict b = bv; \
+	T *restrict c = cv; \
+	for (size_t i = 0; i < m; i++) { \
+		for (size_t j = 0; j < n; j++) { \
+			T sum = 0; \
+			for (size_t p = 0; p < k; p++) { \
+				sum += a[i * k + p] * b[p * n + j]; \
+			} \
+			c[i * n + j] = sum; \
+		} \
+	} \
+	return true; \
+} \
+\
+static bool reordered_##NAME(const void *av, const void *bv, void *cv, size_t m, size_t n, size_t k) { \
+	const T *restrict a = av, *restrict b = bv; \
+	T *restrict c = cv; \
+	memset(c, 0, m * n * sizeof(T)); \
+	for (size_t i = 0; i < m; i++) { \
+		for (size_t p = 0; p < k; p++) { \
+			T x = a[i * k + p]; \
+			for (size_t j = 0; j < n; j++) { \
+				c[i * n + j] += x * b[p * n + j]; \
+			} \
+		} \
+	} \
+	return true; \
+} \
+\
+static bool blocked_##NAME(const void *av, const void *bv, void *cv, size_t m, size_t n, size_t k) { \
+	const T *restrict a = av, *restrict b = bv; \
+	T *restrict c = cv; \
+	memset(c, 0, m * n * sizeof(T)); \
+	for (size_t ii = 0; ii < m; ii += TILE) { \
+		for (size_t pp = 0; pp < k; pp += TILE) { \
+			for (size_t jj = 0; jj < n; jj += TILE) { \
+				size_t i_end = min_size(ii + TILE, m); \
+				size_t p_end = min_size(pp + TILE, k); \
+				size_t j_end = min_size(jj + TILE, n); \
+				for (size_t i = ii; i < i_end; i++) { \
+					for (size_t p = pp; p < p_end; p++) { \
+						T x = a[i * k + p]; \
+						for (size_t j = jj; j < j_end; j++) { \
+							c[i * n + j] += x * b[p * n + j]; \
+						} \
+					} \
+				} \
+			} \
+		} \
+	} \
+	return true; \
+} \
+\
+/* Copy kc rows of nc columns of b into panels of NR columns, padded with zeros */ \
+static void pack_##NAME(const T *b, size_t n, size_t pc, size_t kc, size_t jc, size_t nc, T *packed, bool parallel) { \
+	_Pragma("omp parallel for if(parallel)") \
+	for (size_t jr = 0; jr < nc; jr += NR) { \
+		T *panel = packed + jr * kc; \
+		size_t nr = min_size(NR, nc - jr); \
+		for (size_t p = 0; p < kc; p++) { \
+			const T *row = b + (pc + p) * n + jc + jr; \
+			for (size_t j = 0; j < NR; j++) { \
+				panel[p * NR + j] = j < nr ? row[j] : 0; \
+			} \
+		} \
+	} \
+} \
+\
+/* Portable micro-kernel, used if the CPU has no AVX2 */ \
+static void micro_kernel_##NAME(const T *a, size_t lda, const T *panel, size_t kc, T *c, size_t ldc, size_t mr, size_t nr) { \
+	T tile[MR][NR] = {{0}}; \
+	for (size_t p = 0; p < kc; p++) { \
+		for (size_t r = 0; r < mr; r++) { \
+			T x = a[r * lda + p]; \
+			for (size_t j = 0; j < NR; j++) { \
+				tile[r][j] += x * panel[p * NR + j]; \
+			} \
+		} \
+	} \
+	for (size_t r = 0; r < mr; r++) { \
+		for (size_t j = 0; j < nr; j++) { \
+			c[r * ldc + j] += tile[r][j]; \
+		} \
+	} \
+}
+
+DEFINE_SCALAR_KERNELS(int32_t, int32)
+DEFINE_SCALAR_KERNELS(float, float)
+
+#ifdef HAVE_X86
+/*
+ * The AVX2 micro-kernel keeps a tile of MR x NR of c in 12 registers while
+ * it runs through the depth of the block. Every step loads one row of the
+ * packed panel (2 registers) and broadcasts one value of each of the MR
+ * rows of a. Rows beyond mr read row 0 again, their results are dropped.
+ */
+#define DEFINE_SIMD_KERNEL(T, NAME, VEC, ZERO, LOAD, BROADCAST, MADD, ADD, STORE) \
+__attribute__((target("avx2,fma"))) \
+static void simd_kernel_##NAME(const T *a, size_t lda, const T *panel, size_t kc, T *c, size_t ldc, size_t mr, size_t nr) { \
+	const T *a0 = a; \
+	const T *a1 = mr > 1 ? a + lda : a; \
+	const T *a2 = mr > 2 ? a + 2 * lda : a; \
+	const T *a3 = mr > 3 ? a + 3 * lda : a; \
+	const T *a4 = mr > 4 ? a + 4 * lda : a; \
+	const T *a5 = mr > 5 ? a + 5 * lda : a; \
+	VEC c00 = ZERO, c01 = ZERO, c10 = ZERO, c11 = ZERO, c20 = ZERO, c21 = ZERO; \
+	VEC c30 = ZERO, c31 = ZERO, c40 = ZERO, c41 = ZERO, c50 = ZERO, c51 = ZERO; \
+	for (size_t p = 0; p < kc; p++) { \
+		VEC b0 = LOAD(panel + p * NR); \
+		VEC b1 = LOAD(panel + p * NR + 8); \
+		VEC x = BROADCAST(a0 + p); c00 = MADD(x, b0, c00); c01 = MADD(x, b1, c01); \
+		x = BROADCAST(a1 + p); c10 = MADD(x, b0, c10); c11 = MADD(x, b1, c11); \
+		x = BROADCAST(a2 + p); c20 = MADD(x, b0, c20); c21 = MADD(x, b1, c21); \
+		x = BROADCAST(a3 + p); c30 = MADD(x, b0, c30); c31 = MADD(x, b1, c31); \
+		x = BROADCAST(a4 + p); c40 = MADD(x, b0, c40); c41 = MADD(x, b1, c41); \
+		x = BROADCAST(a5 + p); c50 = MADD(x, b0, c50); c51 = MADD(x, b1, c51); \
+	} \
+	if (mr == MR && nr == NR) { \
+		/* Full tile, add the registers straight to c */ \
+		T *row = c; \
+		STORE(row, ADD(LOAD(row), c00)); STORE(row + 8, ADD(LOAD(row + 8), c01)); row += ldc; \
+		STORE(row, ADD(LOAD(row), c10)); STORE(row + 8, ADD(LOAD(row + 8), c11)); row += ldc; \
+		STORE(row, ADD(LOAD(row), c20)); STORE(row + 8, ADD(LOAD(row + 8), c21)); row += ldc; \
+		STORE(row, ADD(LOAD(row), c30)); STORE(row + 8, ADD(LOAD(row + 8), c31)); row += ldc; \
+		STORE(row, ADD(LOAD(row), c40)); STORE(row + 8, ADD(LOAD(row + 8), c41)); row += ldc; \
+		STORE(row, ADD(LOAD(row), c50)); STORE(row + 8, ADD(LOAD(row + 8), c51)); \
+		return; \
+	} \
+	T tile[MR][NR]; \
+	STORE(tile[0], c00); STORE(tile[0] + 8, c01); \
+	STORE(tile[1], c10); STORE(tile[1] + 8, c11); \
+	STORE(tile[2], c20); STORE(tile[2] + 8, c21); \
+	STORE(tile[3], c30); STORE(tile[3] + 8, c31); \
+	STORE(tile[4], c40); STORE(tile[4] + 8, c41); \
+	STORE(tile[5], c50); STORE(tile[5] + 8, c51); \
+	for (size_t r = 0; r < mr; r++) { \
+		for (size_t j = 0; j < nr; j++) { \
+			c[r * ldc + j] += tile[r][j]; \
+		} \
+	} \
+}
+
+#define LOAD_PS(p) _mm256_loadu_ps(p)
+#define STORE_PS(p, v) _mm256_storeu_ps(p, v)
+#define BROADCAST_PS(p) _mm256_broadcast_ss(p)
+#define MADD_PS(x, b, c) _mm256_fmadd_ps(x, b, c)
+DEFINE_SIMD_KERNEL(float, float, __m256, _mm256_setzero_ps(), LOAD_PS, BROADCAST_PS, MADD_PS, _mm256_add_ps, STORE_PS)
+
+#define LOAD_EPI32(p) _mm256_loadu_si256((const __m256i *) (p))
+#define STORE_EPI32(p, v) _mm256_storeu_si256((__m256i *) (p), v)
+#define BROADCAST_EPI32(p) _mm256_set1_epi32(*(p))
+#define MADD_EPI32(x, b, c) _mm256_add_epi32(c, _mm256_mullo_epi32(x, b))
+DEFINE_SIMD_KERNEL(int32_t, int32, __m256i, _mm256_setzero_si256(), LOAD_EPI32, BROADCAST_EPI32, MADD_EPI32, _mm256_add_epi32, STORE_EPI32)
+#endif
+
+bool has_simd_kernel(void) {
+#ifdef HAVE_X86
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	return false;
+#endif
+}
+
+/*
+ * Multiply block by block: a block of KC rows and NC columns of b is packed
+ * into panels, then every block of MC rows of a is multiplied with every
+ * panel by the micro-kernel, MR rows at a time. With parallel, the pairs of
+ * row blocks and panels are spread over the cores with OpenMP.
+ */
+#define DEFINE_PACKED_MULT(T, NAME) \
+static bool packed_##NAME(const T *a, const T *b, T *c, size_t m, size_t n, size_t k, bool parallel) { \
+	void (*kernel)(const T *, size_t, const T *, size_t, T *, size_t, size_t, size_t) = micro_kernel_##NAME; \
+	SELECT_SIMD_KERNEL(NAME) \
+	T *packed = aligned_alloc(64, KC * NC * sizeof(T)); \
+	if (packed == NULL) { \
+		return false; \
+	} \
+	memset(c, 0, m * n * sizeof(T)); \
+	for (size_t jc = 0; jc < n; jc += NC) { \
+		size_t nc = min_size(NC, n - jc); \
+		for (size_t pc = 0; pc < k; pc += KC) { \
+			size_t kc = min_size(KC, k - pc); \
+			pack_##NAME(b, n, pc, kc, jc, nc, packed, parallel); \
+			_Pragma("omp parallel for collapse(2) schedule(dynamic) if(parallel)") \
+			for (size_t ic = 0; ic < m; ic += MC) { \
+				for (size_t jr = 0; jr < nc; jr += NR) { \
+					size_t i_end = min_size(ic + MC, m); \
+					for (size_t ir = ic; ir < i_end; ir += MR) { \
+						kernel(a + ir * k + pc, k, packed + jr * kc, kc, c + ir * n + jc + jr, n, \
+							min_size(MR, m - ir), min_size(NR, nc - jr)); \
+					} \
+				} \
+			} \
+		} \
+	} \
+	free(packed); \
+	return true; \
+} \
+\
+static bool simd_##NAME(const void *a, const void *b, void *c, size_t m, size_t n, size_t k) { \
+	return packed_##NAME(a, b, c, m, n, k, false); \
+} \
+\
+static bool parallel_##NAME(const void *a, const void *b, void *c, size_t m, size_t n, size_t k) { \
+	return packed_##NAME(a, b, c, m, n, k, true); \
+}
+
+#ifdef HAVE_X86
+#define SELECT_SIMD_KERNEL(NAME) if (has_simd_kernel()) { kernel = simd_kernel_##NAME; }
+#else
+#define SELECT_SIMD_KERNEL(NAME)
+#endif
+
+DEFINE_PACKED_MULT(int32_t, int32)
+DEFINE_PACKED_MULT(float, float)
+
+MultFunction Int32Methods[MULT_METHOD_COUNT] = {
+	naive_int32,
+	reordered_int32,
+	blocked_int32,
+	simd_int32,
+	parallel_int32
+};
+
+MultFunction FloatMethods[MULT_METHOD_COUNT] = {
+	naive_float,
+	reordered_float,
+	blocked_float,
+	simd_float,
+	parallel_float
+};
+
+/*
+ * Computes c = a * b.
+ * Returns false if the types or sizes of the matrices don't match, or if
+ * there is no memory for the packed panels.
+ */
+bool multiply_matrix(const Matrix *a, const Matrix *b, Matrix *c, MultMethod method) {
+	if (a->type != b->type || a->type != c->type || a->cols != b->rows
+			|| c->rows != a->rows || c->cols != b->cols || method >= MULT_METHOD_COUNT) {
+		return false;
+	}
+
+	MultFunction *methods = a->type == MATRIX_FLOAT ? FloatMethods : Int32Methods;
+	return methods[method](a->data, b->data, c->data, a->rows, b->cols, a->cols);
+}
@@ -0,0 +1,39 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+	MATRIX_INT32,
+	MATRIX_FLOAT
+} MatrixType;
+
+/* A row-major matrix of int32_t or float */
+typedef struct {
+	MatrixType type;
+	size_t rows;
+	size_t cols;
+	void *data;
+} Matrix;
+
+/* The ways to multiply, each one builds on the previous one */
+typedef enum {
+	MULT_NAIVE,     /* dot product of a row and a column */
+	MULT_REORDERED, /* i-k-j loop order, the inner loop runs along the rows */
+	MULT_BLOCKED,   /* i-k-j in tiles which stay in the L1/L2 cache */
+	MULT_SIMD,      /* packed panels of b and an AVX2 register-blocked micro-kernel */
+	MULT_PARALLEL,  /* MULT_SIMD with the blocks of c spread over all cores */
+	MULT_METHOD_COUNT /* always keep this as the last element to get the count of methods */
+} MultMethod;
+
+extern const char *MultMethodNames[MULT_METHOD_COUNT];
+
+Matrix *create_matrix(MatrixType type, size_t rows, size_t cols);
+void delete_matrix(Matrix *matrix);
+
+bool multiply_matrix(const Matrix *a, const Matrix *b, Matrix *c, MultMethod method);
+bool has_simd_kernel(void);
+
+#endif
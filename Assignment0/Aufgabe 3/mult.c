@@ -1,20 +1,187 @@
 #include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include "matrix.h"
 
-int main() {
-	int table[10][10];
+#define MIN_SECONDS 0.2     /* small sizes are repeated for at least this long */
+#define NAIVE_MAX 1024      /* larger sizes take too long with the naive method */
+#define REORDERED_MAX 2048  /* the same for the reordered and blocked methods */
+#define SAMPLES 64          /* entries of every result checked with a scalar dot product */
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Prints the multiplication table, the outer product of 1..10 with itself.
+ */
+int print_table(void) {
+	Matrix *column = create_matrix(MATRIX_INT32, 10, 1);
+	Matrix *row = create_matrix(MATRIX_INT32, 1, 10);
+	Matrix *table = create_matrix(MATRIX_INT32, 10, 10);
 
 	for (int i = 0; i < 10; i++) {
-		for (int j = 0; j < 10; j++) {
-			table[i][j] = (i + 1) * (j + 1);
-		}
+		((int32_t *) column->data)[i] = i + 1;
+		((int32_t *) row->data)[i] = i + 1;
 	}
+	multiply_matrix(column, row, table, MULT_NAIVE);
 
 	for (int i = 0; i < 10; i++) {
 		for (int j = 0; j < 10; j++) {
-			printf("%d\t", table[i][j]);
+			printf("%d\t", ((int32_t *) table->data)[i * 10 + j]);
 		}
 		printf("\n");
 	}
 
+	delete_matrix(column);
+	delete_matrix(row);
+	delete_matrix(table);
 	return 0;
 }
+
+/*
+ * Fills the matrix with small integers, so every method computes the exact
+ * same result for floats as well, independent of the order of the sums.
+ */
+void fill_matrix(Matrix *matrix, unsigned int seed) {
+	size_t count = matrix->rows * matrix->cols;
+	for (size_t i = 0; i < count; i++) {
+		seed = seed * 1103515245 + 12345;
+		int value = (seed >> 16) % 10;
+		if (matrix->type == MATRIX_FLOAT) {
+			((float *) matrix->data)[i] = value;
+		} else {
+			((int32_t *) matrix->data)[i] = value;
+		}
+	}
+}
+
+/*
+ * Checks SAMPLES entries of c spread over the whole matrix against a plain
+ * dot product, independent of all methods. The values of fill_matrix keep
+ * the float sums exact.
+ */
+bool check_samples(const Matrix *a, const Matrix *b, const Matrix *c) {
+	size_t n = a->rows;
+	for (size_t s = 0; s < SAMPLES; s++) {
+		size_t i = s * 7919 % n;
+		size_t j = (s * 104729 + n - 1) % n;
+		int64_t sum = 0;
+		for (size_t p = 0; p < n; p++) {
+			if (a->type == MATRIX_FLOAT) {
+				sum += (int64_t) ((float *) a->data)[i * n + p] * (int64_t) ((float *) b->data)[p * n + j];
+			} else {
+				sum += (int64_t) ((int32_t *) a->data)[i * n + p] * ((int32_t *) b->data)[p * n + j];
+			}
+		}
+		bool equal = a->type == MATRIX_FLOAT
+			? ((float *) c->data)[i * n + j] == (float) sum
+			: ((int32_t *) c->data)[i * n + j] == (int32_t) sum;
+		if (!equal) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Runs the method until MIN_SECONDS passed and returns the GFLOP/s, counting
+ * a multiplication and an addition per step. Returns -1 if the result differs
+ * from the expected one or from the samples, where there is no expected one.
+ */
+double measure(const Matrix *a, const Matrix *b, Matrix *c, const Matrix *expected, MultMethod method) {
+	size_t n = a->rows;
+	int runs = 0;
+	double start = now();
+	double elapsed;
+	do {
+		if (!multiply_matrix(a, b, c, method)) {
+			return -1;
+		}
+		runs++;
+		elapsed = now() - start;
+	} while (elapsed < MIN_SECONDS);
+
+	if (!check_samples(a, b, c) || (expected && memcmp(c->data, expected->data, n * n * 4) != 0)) {
+		return -1;
+	}
+	return 2.0 * n * n * n * runs / elapsed / 1e9;
+}
+
+int benchmark(size_t max_size) {
+	printf("GFLOP/s for n x n matrices (int32: billion integer operations per second)\n");
+	printf("SIMD kernel: %s\n", has_simd_kernel() ? "AVX2" : "portable, no AVX2");
+	printf("%6s %6s", "n", "type");
+	for (int m = 0; m < MULT_METHOD_COUNT; m++) {
+		printf(" %10s", MultMethodNames[m]);
+	}
+	printf("\n");
+
+	int failed = 0;
+	for (size_t n = 64; n <= max_size; n *= 2) {
+		for (int t = 0; t < 2; t++) {
+			MatrixType type = t == 0 ? MATRIX_INT32 : MATRIX_FLOAT;
+			/* The scalar reordered method is the reference where it runs, above that only the samples are checked */
+			Matrix *a = create_matrix(type, n, n);
+			Matrix *b = create_matrix(type, n, n);
+			Matrix *c = create_matrix(type, n, n);
+			Matrix *expected = n <= REORDERED_MAX ? create_matrix(type, n, n) : NULL;
+			if (a == NULL || b == NULL || c == NULL || (n <= REORDERED_MAX && expected == NULL)) {
+				printf("Could not allocate %zu x %zu matrices, stopping.\n", n, n);
+				delete_matrix(a);
+				delete_matrix(b);
+				delete_matrix(c);
+				delete_matrix(expected);
+				return 1;
+			}
+			fill_matrix(a, 1);
+			fill_matrix(b, 2);
+			if (expected) {
+				multiply_matrix(a, b, expected, MULT_REORDERED);
+			}
+
+			printf("%6zu %6s", n, type == MATRIX_FLOAT ? "float" : "int32");
+			fflush(stdout);
+			for (int m = 0; m < MULT_METHOD_COUNT; m++) {
+				if ((m == MULT_NAIVE && n > NAIVE_MAX) || ((m == MULT_REORDERED || m == MULT_BLOCKED) && n > REORDERED_MAX)) {
+					printf(" %10s", "-");
+					continue;
+				}
+				double gflops = measure(a, b, c, expected, m);
+				if (gflops < 0) {
+					printf(" %10s", "WRONG");
+					failed++;
+				} else {
+					printf(" %10.2f", gflops);
+				}
+				fflush(stdout);
+			}
+			printf("\n");
+
+			delete_matrix(a);
+			delete_matrix(b);
+			delete_matrix(c);
+			delete_matrix(expected);
+		}
+	}
+
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc == 1) {
+		return print_table();
+	}
+	if (strcmp(argv[1], "-bench") != 0 || argc > 3) {
+		printf("Usage: %s [-bench [max size]]\n", argv[0]);
+		printf("Without arguments the multiplication table is printed.\n");
+		printf("-bench measures every method for sizes from 64 up to max size (default 4096).\n");
+		return 1;
+	}
+
+	size_t max_size = argc == 3 ? strtoul(argv[2], NULL, 10) : 4096;
+	return benchmark(max_size);
+}
@@ -0,0 +1,70 @@
+#!/bin/sh
+# Compares the output of strings with a reference split by tr, for inputs
+# whose tokens and separators cross the 64 byte chunks of the scan and the
+# BUFFER_SIZE blocks. Every input is given as a file, on stdin and through a
+# pipe, which is read in 64 KiB pieces. Run with make check.
+
+export LC_ALL=C
+cd "$(dirname "$0")" || exit 1
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+# spaces n: writes n spaces
+spaces() {
+	head -c "$1" /dev/zero | tr '\0' ' '
+}
+
+# check name: checks the input in $dir/name
+check() {
+	{ cat "$dir/$1"; echo; } | tr -s ' \t\n\r\v\f' '\n' | sed '/^$/d' > "$dir/expected"
+	./strings "$dir/$1" > "$dir/file" || failed=1
+	./strings < "$dir/$1" > "$dir/stdin" || failed=1
+	cat "$dir/$1" | ./strings > "$dir/pipe" || failed=1
+	for mode in file stdin pipe; do
+		if ! cmp -s "$dir/expected" "$dir/$mode"; then
+			echo "FAIL: $1 ($mode)"
+			failed=1
+		fi
+	done
+}
+
+block=1048576 # BUFFER_SIZE
+for offset in 2 1 0 -1 -2; do
+	# A token ends at the end of a block, right before a separator
+	{ spaces $((block - 1 + offset)); printf 'a\nxb'; } > "$dir/end$offset"
+	# A token and a run of separators cross the end of a block
+	{ spaces $((block - 2 + offset)); printf 'ab \t\r\ncd  ef'; } > "$dir/cross$offset"
+	# The same at the end of a 64 byte chunk and of a 64 KiB piece of the pipe
+	{ spaces $((64 - 1 + offset)); printf 'a\nxb'; spaces $((65536 - 68)); printf 'cd\nef'; } > "$dir/small$offset"
+done
+
+# Tokens and separator runs of up to 150 bytes, over several blocks
+awk 'BEGIN {
+	srand(1);
+	split(" |\t|\n|\r|\v|\f", ws, "|");
+	for (size = 0; size < 3 * 1048576; ) {
+		n = int(rand() * 150) + 1;
+		s = "";
+		for (i = 0; i < n; i++) {
+			s = s sprintf("%c", 33 + int(rand() * 94));
+		}
+		n = rand() < 0.8 ? 1 : int(rand() * 150) + 1;
+		for (i = 0; i < n; i++) {
+			s = s ws[int(rand() * 6) + 1];
+		}
+		printf "%s", s;
+		size += length(s);
+	}
+}' > "$dir/random"
+
+for input in "$dir"/*; do
+	name=$(basename "$input")
+	case "$name" in
+	expected|file|stdin|pipe) ;;
+	*) check "$name" ;;
+	esac
+done
+
+[ $failed -eq 0 ] && echo "All checks passed"
+exit $failed
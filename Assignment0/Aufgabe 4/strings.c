@@ -1,18 +1,304 @@
 #include<stdio.h>
+#include<stdint.h>
+#include<stdbool.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<sys/uio.h>
 
-int main() {
-	char *s;
-	scanf("%[^\n]s", s);
+#if defined(__AVX2__) || defined(__SSE2__)
+#include<immintrin.h>
+#endif
 
-	printf("Your string is: %s\n", s);
+#define BUFFER_SIZE (1 << 20)  /* size of the blocks the input is handled in */
+#define WINDOW_SIZE (16 << 20) /* pages of mapped files are dropped after this many bytes */
+#define IOV_BATCH 1024         /* iovecs per writev, IOV_MAX on Linux */
 
-	for (int i = 0; s[i] != '\0'; i++) {
-		if (s[i] == ' ') {
-			printf("\n");
+/*
+ * Splits the input at whitespace (space, \t, \n, \v, \f, \r) and writes
+ * every token on its own line.
+ *
+ * The tokens are not copied to an output buffer: the first separator after
+ * a token is replaced by '\n' in place and the rest of the separators are
+ * skipped, so the output is a list of ranges of the input, which are written
+ * with writev. With single spaces between the tokens a whole block is a
+ * single range.
+ */
+
+typedef struct {
+	struct iovec iov[IOV_BATCH];
+	int count;
+	bool in_token;  /* the last byte handled so far belongs to a token */
+} Tokenizer;
+
+static char Buffer[BUFFER_SIZE];
+
+static bool flush_output(Tokenizer *t) {
+	struct iovec *iov = t->iov;
+	int count = t->count;
+	while (count > 0) {
+		ssize_t written = writev(STDOUT_FILENO, iov, count);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("writev");
+			return false;
+		}
+		/* Skip what was written, a short write can end inside an iovec */
+		while (count > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	t->count = 0;
+	return true;
+}
+
+static bool emit(Tokenizer *t, char *start, size_t length) {
+	if (t->count == IOV_BATCH && !flush_output(t)) {
+		return false;
+	}
+	t->iov[t->count].iov_base = start;
+	t->iov[t->count].iov_len = length;
+	t->count++;
+	return true;
+}
+
+static inline bool is_separator(unsigned char c) {
+	return c == ' ' || (unsigned char) (c - '\t') < 5;
+}
+
+/*
+ * Returns a bit for every separator of the 64 bytes at p.
+ */
+static inline uint64_t separator_mask(const char *p) {
+#if defined(__AVX2__)
+	const __m256i space = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i four = _mm256_set1_epi8(4);
+	uint64_t mask = 0;
+	for (int i = 0; i < 2; i++) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (p + 32 * i));
+		/* c - '\t' <= 4 unsigned, as min(x, 4) == x */
+		__m256i x = _mm256_sub_epi8(v, tab);
+		__m256i controls = _mm256_cmpeq_epi8(_mm256_min_epu8(x, four), x);
+		__m256i separators = _mm256_or_si256(controls, _mm256_cmpeq_epi8(v, space));
+		mask |= (uint64_t) (uint32_t) _mm256_movemask_epi8(separators) << (32 * i);
+	}
+	return mask;
+#elif defined(__SSE2__)
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i four = _mm_set1_epi8(4);
+	uint64_t mask = 0;
+	for (int i = 0; i < 4; i++) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + 16 * i));
+		__m128i x = _mm_sub_epi8(v, tab);
+		__m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(x, four), x);
+		__m128i separators = _mm_or_si128(controls, _mm_cmpeq_epi8(v, space));
+		mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(separators) << (16 * i);
+	}
+	return mask;
+#else
+	uint64_t mask = 0;
+	for (int i = 0; i < 64; i++) {
+		mask |= (uint64_t) is_separator(p[i]) << i;
+	}
+	return mask;
+#endif
+}
+
+/*
+ * Sets the bytes of the 64 bytes at p to '\n' where the bit is set.
+ */
+static inline void mark_line_breaks(char *p, uint64_t bits, int n) {
+#if defined(__AVX2__)
+	if (n == 64) {
+		/* Spread bit i to byte i: every byte gets the byte of the mask it is in, then tests its bit */
+		const __m256i shuffle = _mm256_setr_epi64x(0, 0x0101010101010101, 0x0202020202020202, 0x0303030303030303);
+		const __m256i select = _mm256_set1_epi64x(0x8040201008040201);
+		const __m256i newline = _mm256_set1_epi8('\n');
+		for (int i = 0; i < 2; i++) {
+			__m256i spread = _mm256_shuffle_epi8(_mm256_set1_epi32((uint32_t) (bits >> (32 * i))), shuffle);
+			__m256i mask = _mm256_cmpeq_epi8(_mm256_and_si256(spread, select), select);
+			__m256i v = _mm256_loadu_si256((const __m256i *) (p + 32 * i));
+			_mm256_storeu_si256((__m256i *) (p + 32 * i), _mm256_blendv_epi8(v, newline, mask));
+		}
+		return;
+	}
+#endif
+	(void) n;
+	for (; bits; bits &= bits - 1) {
+		p[__builtin_ctzll(bits)] = '\n';
+	}
+}
+
+/*
+ * Handles 1 to 64 bytes at p, given the mask of their separators. Bytes
+ * which are kept are the tokens and the first separator after each token.
+ * Every change between kept and skipped bytes starts or ends a range.
+ */
+static inline bool tokenize_bits(Tokenizer *t, char *p, uint64_t separators, int n, char **range) {
+	uint64_t valid = n == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << n) - 1;
+	uint64_t tokens = ~separators & valid;
+	uint64_t previous = (tokens << 1) | t->in_token;
+	uint64_t ends = separators & previous & valid;
+	uint64_t keep = tokens | ends;
+
+	/* The first separator after a token becomes the line break */
+	mark_line_breaks(p, ends, n);
+
+	uint64_t changes = (keep ^ ((keep << 1) | (*range != NULL))) & valid;
+	for (; changes; changes &= changes - 1) {
+		int i = __builtin_ctzll(changes);
+		if (keep >> i & 1) {
+			*range = p + i;
 		} else {
-			printf("%c", s[i]);
+			if (!emit(t, *range, p + i - *range)) {
+				return false;
+			}
+			*range = NULL;
+		}
+	}
+
+	t->in_token = tokens >> (n - 1) & 1;
+	return true;
+}
+
+/*
+ * Tokenizes a block of writable memory. A token may continue in the next
+ * block, the output of the block is complete once it was flushed.
+ */
+static bool tokenize_block(Tokenizer *t, char *data, size_t size) {
+	char *range = NULL;
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64) {
+		if (!tokenize_bits(t, data + i, separator_mask(data + i), 64, &range)) {
+			return false;
+		}
+	}
+
+	/* Without a tail, in_token has to stay as the last 64 bytes left it */
+	int n = size - i;
+	if (n > 0) {
+		uint64_t separators = 0;
+		for (int j = 0; j < n; j++) {
+			separators |= (uint64_t) is_separator(data[i + j]) << j;
+		}
+		if (!tokenize_bits(t, data + i, separators, n, &range)) {
+			return false;
+		}
+	}
+
+	return range == NULL || emit(t, range, data + size - range);
+}
+
+/*
+ * Ends an input: the last token gets a line break if the input ended inside
+ * of it.
+ */
+static bool end_input(Tokenizer *t) {
+	static char newline[] = "\n";
+	if (t->in_token) {
+		t->in_token = false;
+		return emit(t, newline, 1) && flush_output(t);
+	}
+	return true;
+}
+
+static bool tokenize_stream(Tokenizer *t, int fd) {
+	for (;;) {
+		ssize_t size = read(fd, Buffer, BUFFER_SIZE);
+		if (size < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("read");
+			return false;
+		}
+		if (size == 0) {
+			return end_input(t);
+		}
+		/* The iovecs point into the buffer, so they are written before it is reused */
+		if (!tokenize_block(t, Buffer, size) || !flush_output(t)) {
+			return false;
+		}
+	}
+}
+
+/*
+ * Tokenizes a file through a read-only mapping. Every block is copied into
+ * the buffer, as the separators are rewritten, and its pages are dropped
+ * from the mapping afterwards, so the memory stays bounded for files of any
+ * size. Writing to a private mapping directly would copy every page on the
+ * first write, which is slower than the copy.
+ */
+static bool tokenize_file(Tokenizer *t, const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror(path);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		/* Pipes, devices and empty files are read like stdin */
+		bool ok = tokenize_stream(t, fd);
+		close(fd);
+		return ok;
+	}
+
+	size_t size = st.st_size;
+	char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		return false;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	bool ok = true;
+	size_t dropped = 0;
+	for (size_t offset = 0; ok && offset < size; offset += BUFFER_SIZE) {
+		size_t block = size - offset < BUFFER_SIZE ? size - offset : BUFFER_SIZE;
+		memcpy(Buffer, data + offset, block);
+		ok = tokenize_block(t, Buffer, block) && flush_output(t);
+
+		if (offset + block - dropped >= WINDOW_SIZE) {
+			madvise(data + dropped, offset + block - dropped, MADV_DONTNEED);
+			dropped = offset + block;
 		}
 	}
 
-	return 0;
+	munmap(data, size);
+	return ok && end_input(t);
+}
+
+int main(int argc, char *argv[]) {
+	static Tokenizer tokenizer;
+
+	if (argc > 1 && strcmp(argv[1], "-h") == 0) {
+		printf("Usage: %s [file...]\n", argv[0]);
+		printf("Writes every whitespace separated token of the files, or of stdin, on its own line.\n");
+		return 1;
+	}
+
+	bool ok = true;
+	if (argc == 1) {
+		ok = tokenize_stream(&tokenizer, STDIN_FILENO);
+	}
+	for (int i = 1; ok && i < argc; i++) {
+		ok = tokenize_file(&tokenizer, argv[i]);
+	}
+
+	return ok ? 0 : 1;
 }
@@ -1,41 +1,280 @@
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <spawn.h>
+#include "./include/prefork.h"
+
+#define MB (1024 * 1024)
+#define CHILD_PATH "/bin/true"  // every spawned child runs this program
+#define MAX_ITERATIONS 500      // spawns per method and size
+#define TIME_BUDGET 1.0         // seconds per method and size, at least MIN_ITERATIONS
+#define MIN_ITERATIONS 10
+#define TASK_COUNT 2000         // tasks for comparing the prefork pool with a process per task
+#define TASK_SIZE 256
+#define STACK_SIZE (64 * 1024)  // stack of the child of clone
+
+// Type definitions
+typedef pid_t (*SpawnFunction)(void);
+
+typedef struct {
+    const char* name;
+    SpawnFunction spawn;
+} SpawnMethod;
+
+// Forward declarations
+pid_t spawn_fork(void);
+pid_t spawn_vfork(void);
+pid_t spawn_posix_spawn(void);
+pid_t spawn_clone(void);
+void benchmark_spawn(const SpawnMethod* method);
+void benchmark_tasks(PreforkPool* pool, int workers);
+int run_task(const void* task, size_t size);
+
+// These functions start a child which runs CHILD_PATH
+SpawnMethod Methods[] = {
+        {"fork", spawn_fork},
+        {"vfork", spawn_vfork},
+        {"posix_spawn", spawn_posix_spawn},
+        {"clone(VM)", spawn_clone},
+};
+
+// The parent sizes to measure, in MiB
+size_t Sizes[] = {1, 16, 256, 1024, 4096};
+
+extern char** environ;
+static char* ChildArgv[] = {CHILD_PATH, NULL};
+static char* CloneStack;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
 int main(int argc, char *argv[]) {
-// fork a process
+    if (argc > 2) {
+        printf("Usage: %s [max parent size in MiB]\n", argv[0]);
+        printf("Measures fork, vfork, posix_spawn and clone with CLONE_VM for growing parent\n");
+        printf("sizes (default up to 4096 MiB), and a prefork pool against a process per task.\n");
+        return 1;
+    }
+    size_t max_size = argc == 2 ? strtoul(argv[1], NULL, 10) : 4096;
+
+    // The pool is forked while the process is still small, like a server
+    // would do at startup
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
+    PreforkPool* pool = create_prefork_pool(workers, run_task);
+    if (pool == NULL) {
+        return 1;
+    }
+    CloneStack = malloc(STACK_SIZE);
+
+    printf("Latency of spawning %s and waiting for it, %d workers for the tasks\n", CHILD_PATH, workers);
+    for (size_t i = 0; i < sizeof(Sizes) / sizeof(Sizes[0]) && Sizes[i] <= max_size; i++) {
+        // Touch every page, so the memory really is part of the RSS
+        size_t size = Sizes[i] * MB;
+        char* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            printf("Could not allocate %zu MiB, stopping.\n", Sizes[i]);
+            break;
+        }
+        memset(memory, 0x5A, size);
+
+        printf("\nParent with %zu MiB\n", Sizes[i]);
+        printf("%-12s %10s %10s %10s %12s\n", "method", "mean us", "p50 us", "p99 us", "per second");
+        for (size_t m = 0; m < sizeof(Methods) / sizeof(Methods[0]); m++) {
+            benchmark_spawn(&Methods[m]);
+        }
+        benchmark_tasks(pool, workers);
+
+        munmap(memory, size);
+    }
+
+    free(CloneStack);
+    delete_prefork_pool(pool);
+    return 0;
+}
+
+pid_t spawn_fork(void) {
+    fflush(stdout);
     pid_t pid = fork();
+    if (pid == 0) {
+        execve(CHILD_PATH, ChildArgv, environ);
+        _exit(127);
+    }
+    return pid;
+}
 
+pid_t spawn_vfork(void) {
+    // The parent is suspended until the child called execve, the child
+    // borrows its memory and may only call execve or _exit
+    pid_t pid = vfork();
     if (pid == 0) {
+        execve(CHILD_PATH, ChildArgv, environ);
+        _exit(127);
+    }
+    return pid;
+}
 
-        // child process
-        pid = getpid();
-        pid_t ppid = getppid();
-        printf("This is child process (pid=%d) with parent %d.\n", pid, ppid);
-        // child sleeps for 5 secods
-        sleep(5);
-        exit(0);
-
-    } else if (pid > 0) {
-
-        // parent process
-        pid = getpid();
-        printf("This is the parent process with process id %d.\n", pid);
-        // wait for child to finish
-        pid = wait(NULL);
-        if (pid == -1) {
-            printf("Wait failed.\n");
-            exit(1);
+pid_t spawn_posix_spawn(void) {
+    pid_t pid;
+    if (posix_spawn(&pid, CHILD_PATH, NULL, NULL, ChildArgv, environ) != 0) {
+        return -1;
+    }
+    return pid;
+}
 
+static int clone_child(void* arg) {
+    (void) arg;
+    execve(CHILD_PATH, ChildArgv, environ);
+    _exit(127);
+}
+
+pid_t spawn_clone(void) {
+    // The child shares the memory of the parent, so nothing has to be
+    // copied, and gets its own stack. The stack is reused, the child
+    // is always waited for before the next one is started.
+    return clone(clone_child, CloneStack + STACK_SIZE, CLONE_VM | SIGCHLD, NULL);
+}
+
+/**
+ * Wait for one child of this process. Only its pid is waited for, so the
+ * workers of the prefork pool are never reaped by accident.
+ * @return 0 if the child exited with status 0, 1 if it failed, -1 if waiting failed
+ */
+static int wait_child(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Spawn children one after another, until MAX_ITERATIONS or the time budget
+ * is reached, and print the latencies of spawning and waiting for a child.
+ */
+void benchmark_spawn(const SpawnMethod* method) {
+    double latencies[MAX_ITERATIONS];
+    int count = 0;
+    int failed = 0;
+
+    double start = now();
+    while (count < MAX_ITERATIONS && (count < MIN_ITERATIONS || now() - start < TIME_BUDGET)) {
+        double t = now();
+        pid_t pid = method->spawn();
+        if (pid < 0) {
+            printf("Fork failed.\n");
+            return;
+        }
+
+        int result = wait_child(pid);
+        if (result == -1) {
+            printf("Wait failed.\n");
+            return;
         }
-        printf("Child %d finished.\n", pid);
-        exit(0);
+        latencies[count++] = now() - t;
+        failed += result;
+    }
+    double total = now() - start;
+
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += latencies[i];
+    }
+    qsort(latencies, count, sizeof(double), compare_doubles);
+    printf("%-12s %10.1f %10.1f %10.1f %12.0f%s\n", method->name,
+           sum / count * 1e6, latencies[count / 2] * 1e6, latencies[count * 99 / 100] * 1e6,
+           count / total, failed ? " (children failed)" : "");
+}
+
+/**
+ * A small task: a checksum of the data.
+ */
+int run_task(const void* task, size_t size) {
+    const unsigned char* data = task;
+    unsigned int sum = 0;
+    for (size_t i = 0; i < size; i++) {
+        sum = sum * 31 + data[i];
+    }
+    return sum == 0xFFFFFFFF;
+}
+
+/**
+ * Run tasks with a process per task, until TASK_COUNT or the time budget is
+ * reached, and TASK_COUNT tasks with the prefork pool. Both run up to one
+ * task per worker at a time.
+ */
+void benchmark_tasks(PreforkPool* pool, int workers) {
+    unsigned char task[TASK_SIZE];
+    for (int i = 0; i < TASK_SIZE; i++) {
+        task[i] = i;
+    }
+
+    // The running children, oldest first. They are waited for in this order,
+    // the tasks all take about the same time.
+    pid_t* pids = malloc(workers * sizeof(pid_t));
+    if (pids == NULL) {
+        printf("Error: could not allocate memory for the children\n");
+        return;
+    }
 
-    } else {
+    double start = now();
+    int oldest = 0;
+    int running = 0;
+    int failed = 0;
+    int count = 0;
+    for (; count < TASK_COUNT && (count < MIN_ITERATIONS || now() - start < TIME_BUDGET); count++) {
+        if (running == workers) {
+            failed += wait_child(pids[oldest]) != 0;
+            oldest = (oldest + 1) % workers;
+            running--;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            _exit(run_task(task, sizeof(task)));
+        } else if (pid < 0) {
+            printf("Fork failed.\n");
+            break;
+        }
+        pids[(oldest + running) % workers] = pid;
+        running++;
+    }
+    for (; running > 0; running--) {
+        failed += wait_child(pids[oldest]) != 0;
+        oldest = (oldest + 1) % workers;
+    }
+    free(pids);
+    double total = now() - start;
+    printf("%-12s %10.1f %10s %10s %12.0f%s\n", "fork/task", total / count * 1e6, "-", "-",
+           count / total, failed ? " (tasks failed)" : "");
 
-        printf("Fork failed.\n");
-        exit(1);
+    start = now();
+    for (int i = 0; i < TASK_COUNT; i++) {
+        if (!submit_prefork_task(pool, task, sizeof(task))) {
+            printf("Error: could not submit a task to the pool\n");
+            break;
+        }
     }
-}
\ No newline at end of file
+    failed = wait_prefork_pool(pool);
+    total = now() - start;
+    printf("%-12s %10.1f %10s %10s %12.0f%s\n", "prefork pool", total / TASK_COUNT * 1e6, "-", "-",
+           TASK_COUNT / total, failed ? " (tasks failed)" : "");
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define PREFORK_MAX_TASK 4096 // the largest task message in bytes
+
+// Runs a task in a worker process, returns 0 on success
+typedef int (*PreforkHandler)(const void* task, size_t size);
+
+typedef struct {
+    pid_t pid;
+    int socket;  // the parent end of the socketpair, the worker has the other end
+    bool busy;   // a task was sent and its result not yet received
+} PreforkWorker;
+
+/**
+ * A pool of worker processes which are forked once and then get their tasks
+ * over a socketpair, instead of a new process per task.
+ */
+typedef struct {
+    PreforkHandler handler;
+    PreforkWorker* workers;
+    int count;
+    int next;    // the worker to try first for the next task
+    int failed;  // number of failed tasks since the last wait_prefork_pool
+} PreforkPool;
+
+PreforkPool* create_prefork_pool(int count, PreforkHandler handler);
+void delete_prefork_pool(PreforkPool* pool);
+
+bool submit_prefork_task(PreforkPool* pool, const void* task, size_t size);
+int wait_prefork_pool(PreforkPool* pool);
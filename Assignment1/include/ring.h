@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/**
+ * Single-producer/single-consumer ring buffer in shared memory. Producer and
+ * consumer only synchronize through the head and tail counters; a futex is
+ * only used when one side has to wait, and only woken when the other side
+ * announced that it waits.
+ */
+typedef struct {
+    _Atomic uint64_t head;          // bytes written so far, only changed by the producer
+    char head_padding[56];          // head and tail on their own cache lines
+    _Atomic uint64_t tail;          // bytes read so far, only changed by the consumer
+    char tail_padding[56];
+    _Atomic uint32_t data_futex;    // incremented when data was written or the ring was closed
+    _Atomic uint32_t space_futex;   // incremented when data was read or the ring was closed
+    _Atomic uint32_t consumer_waiting;
+    _Atomic uint32_t producer_waiting;
+    _Atomic uint32_t closed;        // set by the producer when done, or by the consumer on error
+    size_t capacity;                // power of two
+    char data[];
+} RingBuffer;
+
+RingBuffer* create_ring(size_t capacity);
+void delete_ring(RingBuffer* ring);
+
+size_t write_ring(RingBuffer* ring, const void* data, size_t size);
+size_t read_ring(RingBuffer* ring, void* data, size_t size);
+void close_ring(RingBuffer* ring);
+bool is_ring_closed(RingBuffer* ring);
@@ -0,0 +1,355 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include "./include/ring.h"
+#include "bmp.h"
+#include "mrl.h"
+#include "file_io.h"
+
+#define RING_SIZE (4 << 20) // room for a few blocks, so every stage can run ahead
+
+// Type definitions
+typedef int (*StageFunction)(RingBuffer* in, RingBuffer* out, char* argv[]);
+
+typedef enum {
+    STAGE_DECOMPRESS,
+    STAGE_FILTER,
+    STAGE_COMPRESS,
+    STAGE_COUNT // always keep this as the last element to get the count of stages
+} Stage;
+
+// Forward declarations
+int stage_decompress(RingBuffer* in, RingBuffer* out, char* argv[]);
+int stage_filter(RingBuffer* in, RingBuffer* out, char* argv[]);
+int stage_compress(RingBuffer* in, RingBuffer* out, char* argv[]);
+
+// Every stage runs in its own process, connected by a ring buffer to the next one
+StageFunction Stages[STAGE_COUNT] = {
+        stage_decompress,
+        stage_filter,
+        stage_compress
+};
+
+const char* StageNames[STAGE_COUNT] = {
+        "decompress",
+        "filter",
+        "compress"
+};
+
+int main(int argc, char *argv[]) {
+    if (argc != 4) {
+        printf("Usage: %s <input.mrl> <filter> <output.mrl>\n", argv[0]);
+        printf("Decompresses a BMP compressed with Assignment3, applies a filter of Assignment2\n");
+        printf("and compresses the result, every step in its own process.\n");
+        return 1;
+    }
+
+    // rings[i] connects stage i with stage i + 1
+    RingBuffer* rings[STAGE_COUNT - 1];
+    for (int i = 0; i < STAGE_COUNT - 1; i++) {
+        rings[i] = create_ring(RING_SIZE);
+        if (!rings[i]) {
+            return 1;
+        }
+    }
+
+    pid_t pids[STAGE_COUNT];
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        fflush(stdout);
+        pid_t pid = fork();
+
+        if (pid == 0) {
+
+            // child process, runs one stage and closes its rings, so the
+            // neighbours don't wait forever if it fails
+            RingBuffer* in = i > 0 ? rings[i - 1] : NULL;
+            RingBuffer* out = i < STAGE_COUNT - 1 ? rings[i] : NULL;
+            int status = Stages[i](in, out, argv);
+            if (in) {
+                close_ring(in);
+            }
+            if (out) {
+                close_ring(out);
+            }
+            exit(status);
+
+        } else if (pid < 0) {
+
+            printf("Fork failed.\n");
+            for (int j = 0; j < STAGE_COUNT - 1; j++) {
+                close_ring(rings[j]);
+            }
+            while (wait(NULL) > 0);
+            return 1;
+        }
+        pids[i] = pid;
+    }
+
+    // parent process, wait for all stages to finish. A stage killed by a
+    // signal can't close its rings, so that is done here for the others.
+    int failed = 0;
+    for (int finished = 0; finished < STAGE_COUNT; finished++) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid == -1) {
+            printf("Wait failed.\n");
+            return 1;
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            for (int i = 0; i < STAGE_COUNT; i++) {
+                if (pids[i] == pid) {
+                    printf("Error: the %s stage failed\n", StageNames[i]);
+                }
+            }
+            for (int i = 0; i < STAGE_COUNT - 1; i++) {
+                close_ring(rings[i]);
+            }
+            failed = 1;
+        }
+    }
+
+    for (int i = 0; i < STAGE_COUNT - 1; i++) {
+        delete_ring(rings[i]);
+    }
+    if (failed) {
+        // the compress stage can't tell if the data before a failure was complete
+        unlink(argv[3]);
+    } else {
+        printf("Done.\n");
+    }
+    return failed;
+}
+
+/**
+ * Decompress the input file block by block into the ring.
+ */
+int stage_decompress(RingBuffer* in, RingBuffer* out, char* argv[]) {
+    (void) in;
+    MappedFile input;
+    if (!map_input_file(argv[1], &input)) {
+        return 1;
+    }
+
+    MRLReader reader;
+    if (!init_mrl_reader(&reader, input.data, input.size)) {
+        printf("Error: %s is not a compressed file\n", argv[1]);
+        unmap_file(&input);
+        return 1;
+    }
+
+    char* block = malloc(MRL_BLOCK_SIZE);
+    if (block == NULL) {
+        printf("Error: Failed to allocate memory for the block\n");
+        unmap_file(&input);
+        return 1;
+    }
+
+    int status = 0;
+    size_t block_size;
+    do {
+        // read_mrl_block expects a zeroed buffer
+        memset(block, 0, MRL_BLOCK_SIZE);
+        if (!read_mrl_block(&reader, block, &block_size)) {
+            printf("Error: file %s is corrupted\n", argv[1]);
+            status = 1;
+            break;
+        }
+        if (write_ring(out, block, block_size) != block_size) {
+            status = 1;
+            break;
+        }
+    } while (block_size > 0);
+
+    free(block);
+    unmap_file(&input);
+    return status;
+}
+
+/**
+ * Collect the whole image and pass on the filtered and cropped image. Used for
+ * the filters which need all pixels at once and for compressed bitmaps.
+ * @param header the bitmap header, already read from the ring
+ */
+static int filter_whole_image(RingBuffer* in, RingBuffer* out, char* filter, const unsigned char* header) {
+    size_t capacity = 1 << 20;
+    size_t size = BMP_HEADER_SIZE;
+    unsigned char* data = malloc(capacity);
+    if (data == NULL) {
+        printf("Error: Failed to allocate memory for the image\n");
+        return 1;
+    }
+    memcpy(data, header, BMP_HEADER_SIZE);
+
+    size_t n;
+    while ((n = read_ring(in, data + size, capacity - size)) > 0) {
+        size += n;
+        if (size == capacity) {
+            unsigned char* grown = realloc(data, capacity * 2);
+            if (grown == NULL) {
+                printf("Error: Failed to allocate memory for the image\n");
+                free(data);
+                return 1;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+    }
+
+    bmpImage* bmp = parse_bmp_image(data, size);
+    free(data);
+    if (bmp == NULL) {
+        return 1;
+    }
+
+    int status = run_filter(bmp, filter);
+    if (status == 0) {
+        status = crop_image(bmp);
+    }
+    if (status == 0) {
+        size_t pixel_size = bmp->image_size - BMP_HEADER_SIZE;
+        if (write_ring(out, bmp->header, BMP_HEADER_SIZE) != BMP_HEADER_SIZE
+                || write_ring(out, bmp->pixel_data, pixel_size) != pixel_size) {
+            status = 1;
+        }
+    }
+
+    free_bmp_file(bmp);
+    return status;
+}
+
+/**
+ * Filter the image row by row. A 3x3 kernel only needs the rows above and
+ * below, so only three rows are kept and every filtered and cropped row is
+ * passed on right away, while the next rows are still being decompressed.
+ */
+int stage_filter(RingBuffer* in, RingBuffer* out, char* argv[]) {
+    unsigned char header[BMP_HEADER_SIZE];
+    if (read_ring(in, header, BMP_HEADER_SIZE) != BMP_HEADER_SIZE) {
+        printf("Error: Invalid bitmap header\n");
+        return 1;
+    }
+    if (!check_bmp_header(header)) {
+        return 1;
+    }
+
+    Kernel kernel = get_kernel(argv[2]);
+    if (kernel == NULL || *(int32_t*) &header[30] == BMP_COMPRESSION_MRL) {
+        return filter_whole_image(in, out, argv[2], header);
+    }
+
+    int width = *(int32_t*) &header[18];
+    int height = *(int32_t*) &header[22];
+    size_t row_size = (width * PIXEL_WIDTH + PIXEL_WIDTH) & ~PIXEL_WIDTH;
+    size_t cropped_row_size = crop_bmp_header(header);
+
+    unsigned char* window = malloc(3 * row_size);
+    unsigned char* row = calloc(cropped_row_size, 1); // the padding stays 0
+    if (window == NULL || row == NULL) {
+        printf("Error: Failed to allocate memory for the rows\n");
+        free(window);
+        free(row);
+        return 1;
+    }
+
+    int status = write_ring(out, header, BMP_HEADER_SIZE) == BMP_HEADER_SIZE ? 0 : 1;
+    if (status == 0 && read_ring(in, window, 2 * row_size) != 2 * row_size) {
+        printf("Error: Failed to read pixel data\n");
+        status = 1;
+    }
+
+    // row i is in window slot i % 3
+    for (int i = 1; status == 0 && i < height - 1; i++) {
+        unsigned char* below = window + (i + 1) % 3 * row_size;
+        if (read_ring(in, below, row_size) != row_size) {
+            printf("Error: Failed to read pixel data\n");
+            status = 1;
+            break;
+        }
+
+        const unsigned char* rows[3] = {window + (i - 1) % 3 * row_size, window + i % 3 * row_size, below};
+        filter_row(rows, kernel, width, row);
+        if (write_ring(out, row, cropped_row_size) != cropped_row_size) {
+            status = 1;
+        }
+    }
+
+    // Take the rest of the file, so the previous stage can finish its writes
+    while (status == 0 && read_ring(in, window, row_size) > 0);
+
+    if (status == 0) {
+        printf("Filter %s applied successfully\n", argv[2]);
+    }
+    free(row);
+    free(window);
+    return status;
+}
+
+/**
+ * Compress the data of the ring block by block into the output file. The
+ * size in the header is only known at the end, so it is written last.
+ */
+int stage_compress(RingBuffer* in, RingBuffer* out, char* argv[]) {
+    (void) out;
+    int fd = open(argv[3], O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd == -1) {
+        printf("Error: could not open file %s\n", argv[3]);
+        return 1;
+    }
+
+    char* block = malloc(MRL_BLOCK_SIZE);
+    char* compressed = malloc(MRL_BLOCK_HEADER_SIZE + MRL_BLOCK_SIZE);
+    char header[MRL_HEADER_SIZE];
+    size_t total = 0;
+    int status = 0;
+    if (block == NULL || compressed == NULL) {
+        printf("Error: Failed to allocate memory for the blocks\n");
+        status = 1;
+    }
+
+    // placeholder for the header
+    memset(header, 0, sizeof(header));
+    if (status == 0 && write(fd, header, sizeof(header)) != sizeof(header)) {
+        printf("Error: could not write file %s\n", argv[3]);
+        status = 1;
+    }
+
+    size_t block_size;
+    while (status == 0 && (block_size = read_ring(in, block, MRL_BLOCK_SIZE)) > 0) {
+        size_t compressed_size = compress_mrl_block(block, block_size, compressed);
+        size_t written = 0;
+        while (written < compressed_size) {
+            ssize_t n = write(fd, compressed + written, compressed_size - written);
+            if (n <= 0) {
+                printf("Error: could not write file %s\n", argv[3]);
+                status = 1;
+                break;
+            }
+            written += n;
+        }
+        total += block_size;
+    }
+
+    // nothing arrived if a previous stage failed, that is reported there
+    if (status == 0 && total > 0) {
+        write_mrl_header(header, total);
+        if (pwrite(fd, header, sizeof(header), 0) != sizeof(header)) {
+            printf("Error: could not write file %s\n", argv[3]);
+            status = 1;
+        }
+    } else {
+        status = 1;
+    }
+
+    free(compressed);
+    free(block);
+    close(fd);
+    if (status != 0) {
+        // don't leave the placeholder or a part of the output behind
+        unlink(argv[3]);
+    }
+    return status;
+}
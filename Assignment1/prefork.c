@@ -0,0 +1,221 @@
+#include "./include/prefork.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/**
+ * The loop of a worker: receive a task, run it and send back the result,
+ * until the pool closes the socket.
+ */
+static void run_worker(int socket, PreforkHandler handler) {
+    char task[PREFORK_MAX_TASK];
+    for (;;) {
+        ssize_t size = recv(socket, task, sizeof(task), 0);
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size <= 0) {
+            break;
+        }
+
+        int result = handler(task, size);
+        if (send(socket, &result, sizeof(result), MSG_NOSIGNAL) != sizeof(result)) {
+            break;
+        }
+    }
+    exit(0);
+}
+
+static bool start_worker(PreforkPool* pool, PreforkWorker* worker) {
+    // SOCK_SEQPACKET keeps the boundaries of the messages
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1) {
+        perror("socketpair");
+        return false;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // child process, only keeps its own end of its own socketpair
+        for (int i = 0; i < pool->count; i++) {
+            if (pool->workers[i].socket != -1) {
+                close(pool->workers[i].socket);
+            }
+        }
+        close(sockets[0]);
+        run_worker(sockets[1], pool->handler);
+    } else if (pid < 0) {
+        printf("Fork failed.\n");
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+
+    close(sockets[1]);
+    worker->pid = pid;
+    worker->socket = sockets[0];
+    worker->busy = false;
+    return true;
+}
+
+static void stop_worker(PreforkWorker* worker) {
+    // The worker leaves its loop when the socket is closed
+    close(worker->socket);
+    worker->socket = -1;
+    waitpid(worker->pid, NULL, 0);
+}
+
+/**
+ * Fork the workers of the pool. They inherit the memory of the caller, so a
+ * pool is best created early, while the process is still small.
+ * @param count the number of workers
+ * @param handler the function the workers run for every task
+ * @return the pool, or NULL on error
+ */
+PreforkPool* create_prefork_pool(int count, PreforkHandler handler) {
+    PreforkPool* pool = malloc(sizeof(PreforkPool));
+    pool->handler = handler;
+    pool->workers = malloc(count * sizeof(PreforkWorker));
+    pool->count = count;
+    pool->next = 0;
+    pool->failed = 0;
+    for (int i = 0; i < count; i++) {
+        pool->workers[i].socket = -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!start_worker(pool, &pool->workers[i])) {
+            pool->count = i;
+            delete_prefork_pool(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void delete_prefork_pool(PreforkPool* pool) {
+    wait_prefork_pool(pool);
+    for (int i = 0; i < pool->count; i++) {
+        if (pool->workers[i].socket != -1) {
+            stop_worker(&pool->workers[i]);
+        }
+    }
+    free(pool->workers);
+    free(pool);
+}
+
+/**
+ * Receive the result of a busy worker. A worker which died is replaced by a
+ * new one and its task counts as failed.
+ */
+static void receive_result(PreforkPool* pool, PreforkWorker* worker) {
+    int result;
+    ssize_t size;
+    do {
+        size = recv(worker->socket, &result, sizeof(result), 0);
+    } while (size < 0 && errno == EINTR);
+
+    worker->busy = false;
+    if (size != sizeof(result)) {
+        pool->failed++;
+        stop_worker(worker);
+        start_worker(pool, worker);
+    } else if (result != 0) {
+        pool->failed++;
+    }
+}
+
+/**
+ * Wait until at least one busy worker sent its result.
+ */
+static bool wait_for_result(PreforkPool* pool) {
+    struct pollfd fds[pool->count];
+    int busy = 0;
+    for (int i = 0; i < pool->count; i++) {
+        fds[i].fd = pool->workers[i].busy ? pool->workers[i].socket : -1;
+        fds[i].events = POLLIN;
+        busy += pool->workers[i].busy;
+    }
+    if (busy == 0) {
+        return false;
+    }
+
+    while (poll(fds, pool->count, -1) == -1) {
+        if (errno != EINTR) {
+            perror("poll");
+            return false;
+        }
+    }
+    for (int i = 0; i < pool->count; i++) {
+        if (fds[i].revents) {
+            receive_result(pool, &pool->workers[i]);
+        }
+    }
+    return true;
+}
+
+static bool send_task(PreforkWorker* worker, const void* task, size_t size) {
+    ssize_t sent;
+    do {
+        sent = send(worker->socket, task, size, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == (ssize_t) size;
+}
+
+/**
+ * Hand a task to an idle worker, waiting for one if all are busy. A worker
+ * which died while idle is replaced and the task is sent to the new one.
+ * @param pool the pool
+ * @param task the task, copied to the worker
+ * @param size the size of the task, at most PREFORK_MAX_TASK
+ * @return false if the task could not be sent
+ */
+bool submit_prefork_task(PreforkPool* pool, const void* task, size_t size) {
+    if (size > PREFORK_MAX_TASK || pool->count == 0) {
+        return false;
+    }
+
+    for (;;) {
+        for (int i = 0; i < pool->count; i++) {
+            PreforkWorker* worker = &pool->workers[(pool->next + i) % pool->count];
+            if (worker->busy || worker->socket == -1) {
+                continue;
+            }
+
+            if (!send_task(worker, task, size)) {
+                if (errno != EPIPE && errno != ECONNRESET) {
+                    return false;
+                }
+                stop_worker(worker);
+                if (!start_worker(pool, worker) || !send_task(worker, task, size)) {
+                    return false;
+                }
+            }
+            worker->busy = true;
+            pool->next = (pool->next + i + 1) % pool->count;
+            return true;
+        }
+
+        if (!wait_for_result(pool)) {
+            return false;
+        }
+    }
+}
+
+/**
+ * Wait for the results of all submitted tasks.
+ * @param pool the pool
+ * @return the number of tasks which failed since the last call
+ */
+int wait_prefork_pool(PreforkPool* pool) {
+    while (wait_for_result(pool));
+
+    int failed = pool->failed;
+    pool->failed = 0;
+    return failed;
+}
@@ -0,0 +1,181 @@
+#include "./include/ring.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static void futex_wait(_Atomic uint32_t* futex, uint32_t expected) {
+    // Shared futex (no FUTEX_PRIVATE_FLAG), the ring is mapped in several processes
+    syscall(SYS_futex, futex, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* futex) {
+    syscall(SYS_futex, futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Create a ring buffer in a POSIX shared memory object. The object is
+ * unlinked right away, the mapping is shared with children created by
+ * fork() afterwards.
+ * @param capacity the capacity in bytes, rounded up to a power of two
+ * @return the ring buffer, or NULL on error
+ */
+RingBuffer* create_ring(size_t capacity) {
+    size_t rounded = 4096;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+
+    char name[64];
+    static int counter = 0;
+    snprintf(name, sizeof(name), "/ring-%d-%d", getpid(), counter++);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+        perror("shm_open");
+        return NULL;
+    }
+    shm_unlink(name);
+
+    size_t size = sizeof(RingBuffer) + rounded;
+    if (ftruncate(fd, size) == -1) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+
+    RingBuffer* ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    // The shared memory object is zero-filled, so all counters start at 0
+    ring->capacity = rounded;
+    return ring;
+}
+
+void delete_ring(RingBuffer* ring) {
+    munmap(ring, sizeof(RingBuffer) + ring->capacity);
+}
+
+/**
+ * Write all data to the ring, waiting for free space if necessary.
+ * @param ring the ring, only one process may write to it
+ * @param data the data to write
+ * @param size the size of the data
+ * @return the number of bytes written, less than size if the consumer closed the ring
+ */
+size_t write_ring(RingBuffer* ring, const void* data, size_t size) {
+    const char* bytes = data;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t written = 0;
+
+    while (written < size) {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        size_t space = ring->capacity - (head - tail);
+        if (space == 0) {
+            if (atomic_load(&ring->closed)) {
+                break;
+            }
+            // Announce the wait, then check again so a wake up can't be missed
+            uint32_t seq = atomic_load(&ring->space_futex);
+            atomic_store(&ring->producer_waiting, 1);
+            if (atomic_load(&ring->tail) == tail && !atomic_load(&ring->closed)) {
+                futex_wait(&ring->space_futex, seq);
+            }
+            atomic_store(&ring->producer_waiting, 0);
+            continue;
+        }
+
+        size_t chunk = size - written < space ? size - written : space;
+        size_t offset = head & (ring->capacity - 1);
+        size_t first = chunk < ring->capacity - offset ? chunk : ring->capacity - offset;
+        memcpy(ring->data + offset, bytes + written, first);
+        memcpy(ring->data, bytes + written + first, chunk - first);
+
+        head += chunk;
+        written += chunk;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+
+        atomic_fetch_add(&ring->data_futex, 1);
+        if (atomic_load(&ring->consumer_waiting)) {
+            futex_wake(&ring->data_futex);
+        }
+    }
+
+    return written;
+}
+
+/**
+ * Read data from the ring, waiting until size bytes are available or the
+ * ring is closed.
+ * @param ring the ring, only one process may read from it
+ * @param data buffer for the data
+ * @param size the number of bytes to read
+ * @return the number of bytes read, less than size only if the ring was closed
+ */
+size_t read_ring(RingBuffer* ring, void* data, size_t size) {
+    char* bytes = data;
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t read = 0;
+
+    while (read < size) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t available = head - tail;
+        if (available == 0) {
+            if (atomic_load(&ring->closed)) {
+                // The producer may have written more right before closing
+                if (atomic_load(&ring->head) == tail) {
+                    break;
+                }
+                continue;
+            }
+            uint32_t seq = atomic_load(&ring->data_futex);
+            atomic_store(&ring->consumer_waiting, 1);
+            if (atomic_load(&ring->head) == head && !atomic_load(&ring->closed)) {
+                futex_wait(&ring->data_futex, seq);
+            }
+            atomic_store(&ring->consumer_waiting, 0);
+            continue;
+        }
+
+        size_t chunk = size - read < available ? size - read : available;
+        size_t offset = tail & (ring->capacity - 1);
+        size_t first = chunk < ring->capacity - offset ? chunk : ring->capacity - offset;
+        memcpy(bytes + read, ring->data + offset, first);
+        memcpy(bytes + read + first, ring->data, chunk - first);
+
+        tail += chunk;
+        read += chunk;
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        atomic_fetch_add(&ring->space_futex, 1);
+        if (atomic_load(&ring->producer_waiting)) {
+            futex_wake(&ring->space_futex);
+        }
+    }
+
+    return read;
+}
+
+/**
+ * Close the ring: the producer is done, or the consumer gave up. Wakes up
+ * the other side.
+ * @param ring the ring
+ */
+void close_ring(RingBuffer* ring) {
+    atomic_store(&ring->closed, 1);
+    atomic_fetch_add(&ring->data_futex, 1);
+    atomic_fetch_add(&ring->space_futex, 1);
+    futex_wake(&ring->data_futex);
+    futex_wake(&ring->space_futex);
+}
+
+bool is_ring_closed(RingBuffer* ring) {
+    return atomic_load(&ring->closed);
+}
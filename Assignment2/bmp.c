@@ -0,0 +1,721 @@
+#include "./include/bmp.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <pthread.h>
+#include "mrl.h"
+
+#define ROW_BUFFER_SIZE (64 * 1024)
+#define MAX_THREADS 64
+
+struct Equalizer;
+
+// The part of the image one thread of equalize_image works on
+typedef struct {
+    // private, merged after the first sweep. Even and odd pixels are counted
+    // separately, so runs of equal values don't wait on the same counter.
+    _Alignas(64) uint32_t histogram[2][PIXEL_WIDTH][256];
+    struct Equalizer *equalizer;
+    int first_row;
+    int last_row;
+} EqualizeTask;
+
+typedef struct Equalizer {
+    bmpImage *image;
+    EqualizeTask *tasks;
+    int thread_count;
+    pthread_mutex_t start;      // held until it is known how many threads run
+    pthread_barrier_t barrier;
+    unsigned char lut[PIXEL_WIDTH][256];
+} Equalizer;
+
+double k_smooth[3][3] = {
+        {1.0/9.0, 1.0/9.0, 1.0/9.0},
+        {1.0/9.0, 1.0/9.0, 1.0/9.0},
+        {1.0/9.0, 1.0/9.0, 1.0/9.0}
+};
+
+double k_sharpen[3][3] = {
+        {0, -1, 0},
+        {-1, 5, -1},
+        {0, -1, 0}
+};
+
+double k_edge[3][3] = {
+        {0, 1, 0},
+        {1, -4, 1},
+        {0, 1, 0}
+};
+
+double k_emboss[3][3] = {
+        {2, 1, 0},
+        {1, 1, -1},
+        {0, -1, -2}
+};
+
+
+
+/**
+ * Look up the kernel of a filter.
+ * @return the kernel, or NULL if the filter has none (equalize) or is unknown
+ */
+Kernel get_kernel(const char *filter) {
+    if (strcmp(filter, "smooth") == 0) {
+        return k_smooth;
+    } else if (strcmp(filter, "sharp") == 0) {
+        return k_sharpen;
+    } else if (strcmp(filter, "edge") == 0) {
+        return k_edge;
+    } else if (strcmp(filter, "emboss") == 0) {
+        return k_emboss;
+    }
+    return NULL;
+}
+
+/**
+ * Apply the kernel to a single row. The first and the last pixel have no
+ * neighbours on one side and are left out, so the output is the cropped row.
+ * @param rows the row above, the row itself and the row below
+ * @param kernel the kernel of the filter
+ * @param width the width of the rows in pixels
+ * @param output room for width - 2 pixels
+ */
+void filter_row(const unsigned char *rows[3], Kernel kernel, int width, unsigned char *output) {
+    // j is the column
+    for (int j = 1; j < width - 1; j++) {
+        double sum[3] = {0, 0, 0};
+        for (int p = -1; p <= 1; p++) {
+            const unsigned char *row = rows[1 - p];
+            for (int q = -1; q <= 1; q++) {
+                int offset = (j - q) * PIXEL_WIDTH;
+                double value = kernel[p + 1][q + 1];
+                sum[0] += row[offset] * value;
+                sum[1] += row[offset + 1] * value;
+                sum[2] += row[offset + 2] * value;
+            }
+        }
+
+        for (int k = 0; k < 3; k++) {
+            if (sum[k] < 0) {
+                sum[k] = 0;
+            } else if (sum[k] > 255) {
+                sum[k] = 255;
+            }
+        }
+
+        int offset = (j - 1) * PIXEL_WIDTH;
+        output[offset] = (unsigned char) sum[0];
+        output[offset + 1] = (unsigned char) sum[1];
+        output[offset + 2] = (unsigned char) sum[2];
+    }
+}
+
+unsigned char* apply_kernel(const unsigned char *pixel_data, double kernel[3][3], int width, int height, int padding_size) {
+    int row_size = width * PIXEL_WIDTH + padding_size;
+    unsigned char *output = (unsigned char *) malloc(row_size * height);
+    if (output == NULL) {
+        printf("Error: Failed to allocate memory for output image\n");
+        return NULL;
+    }
+
+    // i is the row
+    for (int i = 1; i < height - 1; i++) {
+        const unsigned char *rows[3] = {
+                pixel_data + (i - 1) * row_size,
+                pixel_data + i * row_size,
+                pixel_data + (i + 1) * row_size
+        };
+        filter_row(rows, kernel, width, output + i * row_size + PIXEL_WIDTH);
+    }
+
+    return output;
+}
+
+/**
+ * Decompress pixel data stored with BMP_COMPRESSION_MRL: the container header
+ * of the codec of Assignment3, followed by one block per row.
+ * @return the uncompressed pixel data, or NULL if the data is corrupted
+ */
+unsigned char* decompress_rows(const unsigned char *data, size_t size, int row_size, int height) {
+    MRLReader reader;
+    if (!init_mrl_reader(&reader, (const char *) data, size)
+            || reader.decompressed_size != (size_t) row_size * height) {
+        return NULL;
+    }
+    reader.block_size = row_size;
+
+    // read_mrl_block expects a zeroed buffer
+    unsigned char *pixel_data = (unsigned char *) calloc((size_t) row_size * height, 1);
+    if (pixel_data == NULL) {
+        return NULL;
+    }
+
+    size_t block_size;
+    do {
+        if (!read_mrl_block(&reader, (char *) pixel_data + reader.decompressed_offset, &block_size)) {
+            free(pixel_data);
+            return NULL;
+        }
+    } while (block_size > 0);
+
+    return pixel_data;
+}
+
+/**
+ * Check that the header is one of a bitmap this tool supports and print why
+ * if it isn't.
+ * @return true if the image is supported
+ */
+bool check_bmp_header(const unsigned char *bmp_header) {
+    if (bmp_header[0] != 'B' || bmp_header[1] != 'M') {
+        printf("Error: It's not a bitmap image\n");
+        return false;
+    }
+
+    int32_t width = *(int32_t *) &bmp_header[18];
+    int32_t height = *(int32_t *) &bmp_header[22];
+    uint16_t bit_depth = *(uint16_t *) &bmp_header[28];
+    int32_t compression = *(int32_t *) &bmp_header[30];
+
+    if (compression != 0 && compression != BMP_COMPRESSION_MRL) {
+        printf("Error: Only uncompressed or MRL compressed bitmaps are supported\n");
+        return false;
+    }
+
+    if (width < 3 || height < 3) {
+        printf("Error: Invalid image size\n");
+        return false;
+    }
+
+    if (bit_depth != 24) {
+        printf("Error: Only 24-bit bitmaps are supported\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Create the image from a checked header and the pixel data as stored in the
+ * file, decompressing it if necessary. Takes ownership of both buffers.
+ */
+static bmpImage *create_bmp_image(unsigned char *bmp_header, unsigned char *pixel_data) {
+    uint32_t image_size = *(uint32_t *) &bmp_header[2];
+    int32_t width = *(int32_t *) &bmp_header[18];
+    int32_t height = *(int32_t *) &bmp_header[22];
+    int32_t compression = *(int32_t *) &bmp_header[30];
+
+    int pixel_bytes_per_row = width * PIXEL_WIDTH;
+    int total_bytes_per_row = (pixel_bytes_per_row + PIXEL_WIDTH) & ~PIXEL_WIDTH;
+    int padding_size = total_bytes_per_row - pixel_bytes_per_row;
+
+    if (compression == BMP_COMPRESSION_MRL) {
+        unsigned char *compressed = pixel_data;
+        pixel_data = decompress_rows(compressed, image_size - BMP_HEADER_SIZE, total_bytes_per_row, height);
+        free(compressed);
+        if (pixel_data == NULL) {
+            printf("Error: Failed to decompress pixel data\n");
+            free(bmp_header);
+            return NULL;
+        }
+
+        // From here on the image is handled like an uncompressed one
+        image_size = BMP_HEADER_SIZE + total_bytes_per_row * height;
+        *(uint32_t *) &bmp_header[2] = image_size;
+        *(int32_t *) &bmp_header[30] = 0;
+        *(uint32_t *) &bmp_header[34] = image_size - BMP_HEADER_SIZE;
+    }
+
+    bmpImage *bmp = (bmpImage *) malloc(sizeof(bmpImage));
+    bmp->header = bmp_header;
+    bmp->pixel_data = pixel_data;
+    bmp->width = width;
+    bmp->height = height;
+    bmp->padding_size = padding_size;
+    bmp->image_size = image_size;
+
+    return bmp;
+}
+
+bmpImage *read_bmp_image(char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Failed to open file\n");
+        return NULL;
+    }
+
+    unsigned char *bmp_header = (unsigned char *) malloc(BMP_HEADER_SIZE);
+
+    ssize_t bytes_read = read(fd, bmp_header, BMP_HEADER_SIZE);
+    if (bytes_read != BMP_HEADER_SIZE) {
+        printf("Error: Invalid bitmap header\n");
+        return NULL;
+    }
+
+    if (!check_bmp_header(bmp_header)) {
+        return NULL;
+    }
+
+    uint32_t image_size = *(uint32_t *) &bmp_header[2];
+    unsigned char *pixel_data = (unsigned char *) malloc(image_size - BMP_HEADER_SIZE);
+    if (pixel_data == NULL) {
+        printf("Error: Failed to allocate memory for pixel data\n");
+        return NULL;
+    }
+
+    bytes_read = read(fd, pixel_data, image_size - BMP_HEADER_SIZE);
+    if (bytes_read != image_size - BMP_HEADER_SIZE) {
+        printf("Error: Failed to read pixel data\n");
+        return NULL;
+    }
+
+    close(fd);
+
+    return create_bmp_image(bmp_header, pixel_data);
+}
+
+/**
+ * Create the image from a bitmap file in memory, e.g. received from another
+ * process. The data is copied.
+ * @param data the content of the bitmap file
+ * @param size the size of the data
+ * @return the image, or NULL if the data is not a supported bitmap
+ */
+bmpImage *parse_bmp_image(const unsigned char *data, size_t size) {
+    if (size < BMP_HEADER_SIZE) {
+        printf("Error: Invalid bitmap header\n");
+        return NULL;
+    }
+    if (!check_bmp_header(data)) {
+        return NULL;
+    }
+
+    uint32_t image_size = *(uint32_t *) &data[2];
+    if (image_size < BMP_HEADER_SIZE || image_size > size) {
+        printf("Error: Failed to read pixel data\n");
+        return NULL;
+    }
+
+    unsigned char *bmp_header = (unsigned char *) malloc(BMP_HEADER_SIZE);
+    unsigned char *pixel_data = (unsigned char *) malloc(image_size - BMP_HEADER_SIZE);
+    if (bmp_header == NULL || pixel_data == NULL) {
+        printf("Error: Failed to allocate memory for pixel data\n");
+        free(bmp_header);
+        free(pixel_data);
+        return NULL;
+    }
+    memcpy(bmp_header, data, BMP_HEADER_SIZE);
+    memcpy(pixel_data, data + BMP_HEADER_SIZE, image_size - BMP_HEADER_SIZE);
+
+    return create_bmp_image(bmp_header, pixel_data);
+}
+
+void free_bmp_file(bmpImage *bmp) {
+    free(bmp->header);
+    free(bmp->pixel_data);
+    free(bmp);
+}
+
+/**
+ * Build the lookup table of a channel from its histogram: every value is
+ * mapped to its position in the cumulative histogram, scaled to 0-255, so
+ * the values of the channel spread over the whole range.
+ */
+static void build_equalize_lut(const uint64_t *histogram, unsigned char *lut) {
+    uint64_t total = 0;
+    uint64_t cdf_min = 0;
+    for (int v = 0; v < 256; v++) {
+        if (total == 0) {
+            cdf_min = histogram[v];
+        }
+        total += histogram[v];
+    }
+
+    // A channel with a single value can't be spread
+    if (total == cdf_min) {
+        for (int v = 0; v < 256; v++) {
+            lut[v] = v;
+        }
+        return;
+    }
+
+    uint64_t cdf = 0;
+    for (int v = 0; v < 256; v++) {
+        cdf += histogram[v];
+        lut[v] = cdf <= cdf_min ? 0 : (unsigned char) (((cdf - cdf_min) * 255 + (total - cdf_min) / 2) / (total - cdf_min));
+    }
+}
+
+/**
+ * One thread of equalize_image. The first sweep counts the values of its
+ * rows into its private histograms, the first thread merges them and builds
+ * the lookup tables, and the second sweep remaps the rows. Only the pixels
+ * kept by crop_image are counted, the border would skew the histogram.
+ */
+static void *run_equalize_task(void *arg) {
+    EqualizeTask *task = arg;
+    Equalizer *equalizer = task->equalizer;
+
+    // Wait until the rows of the task are known
+    pthread_mutex_lock(&equalizer->start);
+    pthread_mutex_unlock(&equalizer->start);
+
+    bmpImage *image = equalizer->image;
+    int row_size = image->width * PIXEL_WIDTH + image->padding_size;
+    int row_bytes = image->width * PIXEL_WIDTH;
+    int first_row = task->first_row > 1 ? task->first_row : 1;
+    int last_row = task->last_row < image->height - 1 ? task->last_row : image->height - 1;
+
+    uint32_t (*even)[256] = task->histogram[0];
+    uint32_t (*odd)[256] = task->histogram[1];
+    memset(task->histogram, 0, sizeof(task->histogram));
+    for (int row = first_row; row < last_row; row++) {
+        const unsigned char *p = image->pixel_data + (size_t) row * row_size;
+        int i = PIXEL_WIDTH;
+        int end = row_bytes - PIXEL_WIDTH;
+        for (; i + 2 * PIXEL_WIDTH <= end; i += 2 * PIXEL_WIDTH) {
+            even[0][p[i]]++;
+            even[1][p[i + 1]]++;
+            even[2][p[i + 2]]++;
+            odd[0][p[i + 3]]++;
+            odd[1][p[i + 4]]++;
+            odd[2][p[i + 5]]++;
+        }
+        for (; i < end; i += PIXEL_WIDTH) {
+            even[0][p[i]]++;
+            even[1][p[i + 1]]++;
+            even[2][p[i + 2]]++;
+        }
+    }
+
+    if (pthread_barrier_wait(&equalizer->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        for (int c = 0; c < PIXEL_WIDTH; c++) {
+            uint64_t histogram[256] = {0};
+            for (int t = 0; t < equalizer->thread_count; t++) {
+                for (int v = 0; v < 256; v++) {
+                    histogram[v] += equalizer->tasks[t].histogram[0][c][v] + equalizer->tasks[t].histogram[1][c][v];
+                }
+            }
+            build_equalize_lut(histogram, equalizer->lut[c]);
+        }
+    }
+    pthread_barrier_wait(&equalizer->barrier);
+
+    // Lookups of 256 entries don't fit a byte shuffle, so the loop is
+    // unrolled to 4 pixels and left to the load ports
+    const unsigned char *blue = equalizer->lut[0];
+    const unsigned char *green = equalizer->lut[1];
+    const unsigned char *red = equalizer->lut[2];
+    for (int row = task->first_row; row < task->last_row; row++) {
+        unsigned char *p = image->pixel_data + (size_t) row * row_size;
+        int i = 0;
+        for (; i + 4 * PIXEL_WIDTH <= row_bytes; i += 4 * PIXEL_WIDTH) {
+            p[i] = blue[p[i]];
+            p[i + 1] = green[p[i + 1]];
+            p[i + 2] = red[p[i + 2]];
+            p[i + 3] = blue[p[i + 3]];
+            p[i + 4] = green[p[i + 4]];
+            p[i + 5] = red[p[i + 5]];
+            p[i + 6] = blue[p[i + 6]];
+            p[i + 7] = green[p[i + 7]];
+            p[i + 8] = red[p[i + 8]];
+            p[i + 9] = blue[p[i + 9]];
+            p[i + 10] = green[p[i + 10]];
+            p[i + 11] = red[p[i + 11]];
+        }
+        for (; i < row_bytes; i += PIXEL_WIDTH) {
+            p[i] = blue[p[i]];
+            p[i + 1] = green[p[i + 1]];
+            p[i + 2] = red[p[i + 2]];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Equalize the histogram of every channel in place, to raise the contrast of
+ * low-contrast images. The rows are split between one thread per core, or
+ * fewer if not all threads can be created. The histogram is built from the
+ * pixels which are left after crop_image.
+ * @return 0 on success
+ */
+int equalize_image(bmpImage *image) {
+    int thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count < 1) {
+        thread_count = 1;
+    }
+    if (thread_count > MAX_THREADS) {
+        thread_count = MAX_THREADS;
+    }
+    if (thread_count > image->height) {
+        thread_count = image->height;
+    }
+
+    Equalizer equalizer;
+    equalizer.image = image;
+    equalizer.tasks = aligned_alloc(64, thread_count * sizeof(EqualizeTask));
+    if (equalizer.tasks == NULL) {
+        printf("Error: Failed to allocate memory for the histograms\n");
+        return 1;
+    }
+    for (int t = 0; t < thread_count; t++) {
+        equalizer.tasks[t].equalizer = &equalizer;
+    }
+
+    // The threads wait for their rows until it is known how many of them run.
+    // The calling thread takes the first part.
+    pthread_mutex_init(&equalizer.start, NULL);
+    pthread_mutex_lock(&equalizer.start);
+    pthread_t threads[MAX_THREADS];
+    int started = 1;
+    while (started < thread_count
+            && pthread_create(&threads[started], NULL, run_equalize_task, &equalizer.tasks[started]) == 0) {
+        started++;
+    }
+
+    equalizer.thread_count = started;
+    for (int t = 0; t < started; t++) {
+        EqualizeTask *task = &equalizer.tasks[t];
+        task->first_row = (int) ((int64_t) image->height * t / started);
+        task->last_row = (int) ((int64_t) image->height * (t + 1) / started);
+    }
+    pthread_barrier_init(&equalizer.barrier, NULL, started);
+    pthread_mutex_unlock(&equalizer.start);
+
+    run_equalize_task(&equalizer.tasks[0]);
+    for (int t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    pthread_barrier_destroy(&equalizer.barrier);
+    pthread_mutex_destroy(&equalizer.start);
+    free(equalizer.tasks);
+    return 0;
+}
+
+int run_filter(bmpImage *image, char *filter) {
+    Kernel kernel = get_kernel(filter);
+    unsigned char *output;
+
+    if (kernel != NULL) {
+        output = apply_kernel(image->pixel_data, kernel, image->width, image->height, image->padding_size);
+    } else if (strcmp(filter, "equalize") == 0) {
+        // Works in place, there is no new pixel data
+        if (equalize_image(image) != 0) {
+            return -1;
+        }
+        printf("Filter %s applied successfully\n", filter);
+        return 0;
+    } else {
+        printf("Error: Unknown filter\n");
+        return -1;
+    }
+
+    printf("Filter %s applied successfully\n", filter);
+
+    free(image->pixel_data);
+    image->pixel_data = output;
+
+    return 0;
+}
+
+/**
+ * Update a bitmap header to the image cropped by one pixel on every side.
+ * @param bmp_header the header to update
+ * @return the size of a cropped row, with its padding
+ */
+int crop_bmp_header(unsigned char *bmp_header) {
+    int cropped_width = *(int32_t*) &bmp_header[18] - 2;
+    int cropped_height = *(int32_t*) &bmp_header[22] - 2;
+    int cropped_pixel_bytes_per_row = cropped_width * PIXEL_WIDTH;
+    int cropped_row_size = (cropped_pixel_bytes_per_row + PIXEL_WIDTH) & ~PIXEL_WIDTH;
+    int cropped_image_size = cropped_row_size * cropped_height;
+
+    *(uint32_t*) &bmp_header[2] = BMP_HEADER_SIZE + cropped_image_size;
+    *(uint32_t*) &bmp_header[18] = cropped_width;
+    *(uint32_t*) &bmp_header[22] = cropped_height;
+    *(uint32_t*) &bmp_header[34] = cropped_image_size;
+
+    return cropped_row_size;
+}
+
+int crop_image(bmpImage* image) {
+    int width = image->width;
+    int height = image->height;
+    int padding_size = image->padding_size;
+
+    int cropped_width = width - 2;
+    int cropped_height = height - 2;
+    int cropped_row_size = crop_bmp_header(image->header);
+    int cropped_padding_size = cropped_row_size - cropped_width * PIXEL_WIDTH;
+    int cropped_image_size = cropped_row_size * cropped_height;
+
+    unsigned char* cropped_pixel_data = (unsigned char*) malloc(cropped_image_size);
+    if (cropped_pixel_data == NULL) {
+        printf("Error: Failed to allocate memory for cropped pixel data\n");
+        return 1;
+    }
+
+    unsigned char* pixel_data = image->pixel_data;
+
+    for(int row = 1; row < height - 1; row++) {
+        for(int col = 1; col < width - 1; col++) {
+            int offset = row  * (width * PIXEL_WIDTH + padding_size) + col * PIXEL_WIDTH;
+            int new_offset = (row - 1) * cropped_row_size + (col - 1) * PIXEL_WIDTH;
+
+            cropped_pixel_data[new_offset] = pixel_data[offset];
+            cropped_pixel_data[new_offset + 1] = pixel_data[offset + 1];
+            cropped_pixel_data[new_offset + 2] = pixel_data[offset + 2];
+        }
+    }
+
+    free(image->pixel_data);
+    image->pixel_data = cropped_pixel_data;
+    image->width = cropped_width;
+    image->height = cropped_height;
+    image->padding_size = cropped_padding_size;
+    image->image_size = BMP_HEADER_SIZE + cropped_image_size;
+
+    return 0;
+}
+
+/**
+ * Filter the rows with the kernel, or only crop them if there is none, and
+ * compress every row as soon as it is done. The rows are written as blocks
+ * of the codec of Assignment3 after a single container header and collected
+ * in a buffer, so there is no write per row. The bitmap header is written at
+ * the start of the file at the end, when the compressed size is known.
+ * @return 0 on success
+ */
+static int save_compressed_rows(bmpImage* image, Kernel kernel, int fd) {
+    int width = image->width;
+    int height = image->height;
+    int row_size = width * PIXEL_WIDTH + image->padding_size;
+
+    unsigned char bmp_header[BMP_HEADER_SIZE];
+    memcpy(bmp_header, image->header, BMP_HEADER_SIZE);
+    int cropped_row_size = crop_bmp_header(bmp_header);
+    int cropped_height = height - 2;
+
+    size_t capacity = MRL_BLOCK_HEADER_SIZE + cropped_row_size;
+    if (capacity < ROW_BUFFER_SIZE) {
+        capacity = ROW_BUFFER_SIZE;
+    }
+    char* buffer = (char*) malloc(capacity);
+    unsigned char* row = (unsigned char*) calloc(cropped_row_size, 1); // the padding stays 0
+    if (buffer == NULL || row == NULL) {
+        printf("Error: Failed to allocate memory for the row buffer\n");
+        free(buffer);
+        free(row);
+        return 1;
+    }
+
+    write_mrl_header(buffer, (size_t) cropped_row_size * cropped_height);
+    size_t buffered = MRL_HEADER_SIZE;
+    size_t payload_size = MRL_HEADER_SIZE;
+    bool ok = true;
+    for (int i = 1; i < height - 1 && ok; i++) {
+        const unsigned char* source = image->pixel_data + i * row_size;
+        if (kernel != NULL) {
+            const unsigned char* rows[3] = {source - row_size, source, source + row_size};
+            filter_row(rows, kernel, width, row);
+        } else {
+            memcpy(row, source + PIXEL_WIDTH, (width - 2) * PIXEL_WIDTH);
+        }
+
+        if (buffered + MRL_BLOCK_HEADER_SIZE + cropped_row_size > capacity) {
+            ok = write(fd, buffer, buffered) == (ssize_t) buffered;
+            buffered = 0;
+        }
+        size_t compressed_size = compress_mrl_block((const char*) row, cropped_row_size, buffer + buffered);
+        buffered += compressed_size;
+        payload_size += compressed_size;
+    }
+    if (ok && buffered > 0) {
+        ok = write(fd, buffer, buffered) == (ssize_t) buffered;
+    }
+    free(row);
+    free(buffer);
+    if (!ok) {
+        printf("Error: Failed to write pixel data\n");
+        return 1;
+    }
+
+    *(uint32_t*) &bmp_header[2] = BMP_HEADER_SIZE + payload_size;
+    *(int32_t*) &bmp_header[30] = BMP_COMPRESSION_MRL;
+    *(uint32_t*) &bmp_header[34] = payload_size;
+    if (pwrite(fd, bmp_header, BMP_HEADER_SIZE, 0) != BMP_HEADER_SIZE) {
+        printf("Error: Failed to write bitmap header\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Apply the filter and save the cropped image with compressed pixel data.
+ * Filters with a kernel are applied row by row and every row is compressed
+ * as it comes out of the filter. Equalizing needs the histogram of the whole
+ * image, so it is applied first.
+ * @return 0 on success
+ */
+int save_filtered_image(bmpImage* image, char* filter, char* filename) {
+    Kernel kernel = get_kernel(filter);
+    if (kernel == NULL && run_filter(image, filter) != 0) {
+        return -1;
+    }
+
+    int fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, 0666);
+    if (fd < 0) {
+        printf("Error: Failed to create output file\n");
+        return 1;
+    }
+
+    // The header is written again at the end, with the compressed size
+    int status = 0;
+    if (write(fd, image->header, BMP_HEADER_SIZE) != BMP_HEADER_SIZE) {
+        printf("Error: Failed to write bitmap header\n");
+        status = 1;
+    }
+    if (status == 0) {
+        status = save_compressed_rows(image, kernel, fd);
+    }
+    close(fd);
+
+    if (status == 0 && kernel != NULL) {
+        printf("Filter %s applied successfully\n", filter);
+    }
+    return status;
+}
+
+int save_image(bmpImage* image, char* filename) {
+    if (image == NULL) {
+        return 1;
+    }
+
+    int fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, 0666);
+    if (fd < 0) {
+        printf("Error: Failed to create output file\n");
+        return 1;
+    }
+
+    unsigned char* bmp_header = image->header;
+    unsigned char* pixel_data = image->pixel_data;
+    uint32_t image_size = image->image_size;
+
+    write(fd, bmp_header, BMP_HEADER_SIZE);
+
+    long bytes_read = write(fd, pixel_data, image_size - BMP_HEADER_SIZE);
+    if (bytes_read != image_size - BMP_HEADER_SIZE) {
+        printf("Error: Failed to write pixel data\n");
+        return 1;
+    }
+
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define BMP_HEADER_SIZE 54
+#define PIXEL_WIDTH 3
+#define BMP_COMPRESSION_MRL 0x434C524D // "MRLC": one container of the codec of Assignment3, one block per row
+
+typedef struct {
+    unsigned char *header;
+    unsigned char *pixel_data;
+    int width;
+    int height;
+    int padding_size;
+    uint32_t image_size;
+} bmpImage;
+
+// A 3x3 filter kernel
+typedef double (*Kernel)[3];
+
+bool check_bmp_header(const unsigned char *bmp_header);
+bmpImage *read_bmp_image(char *filename);
+bmpImage *parse_bmp_image(const unsigned char *data, size_t size);
+void free_bmp_file(bmpImage *bmp);
+
+Kernel get_kernel(const char *filter);
+void filter_row(const unsigned char *rows[3], Kernel kernel, int width, unsigned char *output);
+int run_filter(bmpImage *image, char *filter);
+int equalize_image(bmpImage *image);
+int crop_bmp_header(unsigned char *bmp_header);
+int crop_image(bmpImage* image);
+int save_image(bmpImage* image, char* filename);
+int save_filtered_image(bmpImage* image, char* filter, char* filename);
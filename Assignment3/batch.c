@@ -0,0 +1,639 @@
+#include "./include/batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "./include/mrl.h"
+#include "./include/file_io.h"
+#include "./include/uring.h"
+
+#define BATCH_OUTPUT_SIZE (MRL_HEADER_SIZE + MRL_BLOCK_HEADER_SIZE + BATCH_BUFFER_SIZE)
+#define URING_ENTRIES (4 * BATCH_SLOTS)
+#define TAG_EVENT 1 // user_data of the read of the eventfd
+#define TAG_IGNORE 2 // user_data of operations whose result is not needed
+
+// Type definitions
+typedef enum {
+    SLOT_FREE,
+    SLOT_OPEN_INPUT,
+    SLOT_READ,
+    SLOT_ENCODE,       // with the workers
+    SLOT_OPEN_OUTPUT,
+    SLOT_WRITE,
+    SLOT_CLOSE_OUTPUT
+} SlotState;
+
+// A file in flight, with its buffers from the pool
+typedef struct BatchSlot {
+    SlotState state;
+    const char* path;
+    char* out_path;
+    int fd;
+    char* input;
+    char* output;
+    unsigned buffer_index;  // index of the input buffer in the registered buffers, the output follows
+    size_t file_size;       // size of the input file when it was opened
+    size_t input_size;
+    size_t output_size;
+    size_t written;
+    bool direct;            // compressed and written by a worker with the normal path
+    bool failed;
+    struct BatchSlot* next; // in the job queue, the done list or the free list
+} BatchSlot;
+
+typedef struct {
+    // shared with the workers, guarded by lock
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    BatchSlot* jobs;
+    BatchSlot* jobs_tail;
+    BatchSlot* done;
+    bool stop;
+    int event;              // eventfd, written by the workers when a slot is done
+
+    // only used by the main thread
+    BatchSlot slots[BATCH_SLOTS];
+    BatchSlot* free;
+    char* buffers;
+    size_t buffers_size;
+    bool use_uring;
+    Uring ring;
+    uint64_t event_value;
+    int active;
+    int closing;            // closes of inputs and failed files which did not complete yet
+    uint64_t files;
+    uint64_t failed;
+    uint64_t input_bytes;
+    uint64_t output_bytes;
+} Batch;
+
+// Forward declarations
+static void delete_batch(Batch* batch);
+static void* run_worker(void* arg);
+static void encode_slot(BatchSlot* slot);
+static void queue_job(Batch* batch, BatchSlot* slot);
+static BatchSlot* take_done(Batch* batch);
+static void start_slot(Batch* batch, BatchSlot* slot, const char* path);
+static void finish_slot(Batch* batch, BatchSlot* slot);
+static void run_uring(Batch* batch, char** paths, size_t count);
+static void run_plain(Batch* batch, char** paths, size_t count);
+static char** read_file_list(const char* path, char** content, size_t* count);
+char* get_compressed_file_path(const char *filePath); // in main.c
+
+// These operations are used by the batch mode, older kernels fall back to plain system calls
+static const uint8_t UringOps[] = {
+        IORING_OP_OPENAT,
+        IORING_OP_READ_FIXED,
+        IORING_OP_WRITE_FIXED,
+        IORING_OP_CLOSE,
+        IORING_OP_READ
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Compress every file listed in the list file, one path per line, next to
+ * the file like the normal compression does. Reads and writes are submitted
+ * through io_uring with a pool of registered buffers, while a pool of
+ * worker threads encodes the files already read. Without io_uring, the
+ * workers open, read and write the files with plain system calls.
+ * @param list_path the file with the paths
+ * @return 0 if all files were compressed
+ */
+int run_batch(const char *list_path) {
+    char* content;
+    size_t count;
+    char** paths = read_file_list(list_path, &content, &count);
+    if (!paths) {
+        return 1;
+    }
+
+    Batch* batch = calloc(1, sizeof(Batch));
+    if (!batch) {
+        printf("Error: could not allocate memory for the batch\n");
+        free(paths);
+        free(content);
+        return 1;
+    }
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->ready, NULL);
+    batch->event = eventfd(0, EFD_CLOEXEC);
+
+    // One mapping for all buffers, registered at once with the ring
+    size_t slot_size = (BATCH_BUFFER_SIZE + BATCH_OUTPUT_SIZE + 4095) & ~(size_t) 4095;
+    batch->buffers_size = BATCH_SLOTS * slot_size;
+    batch->buffers = mmap(NULL, batch->buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (batch->event == -1 || batch->buffers == MAP_FAILED) {
+        print_file_error(batch->event == -1 ? "could not create eventfd for" : "could not map buffers for",
+                         list_path);
+        delete_batch(batch);
+        free(paths);
+        free(content);
+        return 1;
+    }
+
+    struct iovec iovecs[2 * BATCH_SLOTS];
+    for (int i = BATCH_SLOTS - 1; i >= 0; i--) {
+        BatchSlot* slot = &batch->slots[i];
+        slot->input = batch->buffers + i * slot_size;
+        slot->output = slot->input + BATCH_BUFFER_SIZE;
+        slot->buffer_index = 2 * i;
+        iovecs[2 * i] = (struct iovec) {slot->input, BATCH_BUFFER_SIZE};
+        iovecs[2 * i + 1] = (struct iovec) {slot->output, BATCH_OUTPUT_SIZE};
+        slot->next = batch->free;
+        batch->free = slot;
+    }
+
+    batch->use_uring = init_uring(&batch->ring, URING_ENTRIES, UringOps, sizeof(UringOps));
+    if (batch->use_uring && !register_uring_buffers(&batch->ring, iovecs, 2 * BATCH_SLOTS)) {
+        close_uring(&batch->ring);
+        batch->use_uring = false;
+    }
+
+    // Continue with fewer workers if not all of them can be started
+    int worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t workers[worker_count];
+    int started = 0;
+    while (started < worker_count && pthread_create(&workers[started], NULL, run_worker, batch) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        printf("Error: could not start the workers\n");
+        delete_batch(batch);
+        free(paths);
+        free(content);
+        return 1;
+    }
+    worker_count = started;
+
+    double start = now();
+    if (batch->use_uring) {
+        run_uring(batch, paths, count);
+    } else {
+        run_plain(batch, paths, count);
+    }
+    double seconds = now() - start;
+
+    pthread_mutex_lock(&batch->lock);
+    batch->stop = true;
+    pthread_cond_broadcast(&batch->ready);
+    pthread_mutex_unlock(&batch->lock);
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    printf("Compressed %lu files with %s and %d workers, %lu failed\n", batch->files,
+           batch->use_uring ? "io_uring" : "plain system calls", worker_count, batch->failed);
+    printf("%.1f MB -> %.1f MB in %.3f s: %.0f files/s, %.1f MB/s\n",
+           batch->input_bytes / 1e6, batch->output_bytes / 1e6, seconds,
+           seconds > 0 ? batch->files / seconds : 0.0, seconds > 0 ? batch->input_bytes / 1e6 / seconds : 0.0);
+
+    int status = batch->failed ? 1 : 0;
+    delete_batch(batch);
+    free(paths);
+    free(content);
+    return status;
+}
+
+/**
+ * Release the ring, the buffers and the eventfd of the batch, as far as they
+ * were created. The workers must have been joined.
+ */
+static void delete_batch(Batch* batch) {
+    if (batch->use_uring) {
+        close_uring(&batch->ring);
+    }
+    if (batch->buffers && batch->buffers != MAP_FAILED) {
+        munmap(batch->buffers, batch->buffers_size);
+    }
+    if (batch->event != -1) {
+        close(batch->event);
+    }
+    pthread_cond_destroy(&batch->ready);
+    pthread_mutex_destroy(&batch->lock);
+    free(batch);
+}
+
+static void* run_worker(void* arg) {
+    Batch* batch = arg;
+    pthread_mutex_lock(&batch->lock);
+    for (;;) {
+        while (!batch->jobs && !batch->stop) {
+            pthread_cond_wait(&batch->ready, &batch->lock);
+        }
+        BatchSlot* slot = batch->jobs;
+        if (!slot) {
+            break;
+        }
+        batch->jobs = slot->next;
+        pthread_mutex_unlock(&batch->lock);
+
+        encode_slot(slot);
+
+        pthread_mutex_lock(&batch->lock);
+        slot->next = batch->done;
+        batch->done = slot;
+        uint64_t one = 1;
+        if (write(batch->event, &one, sizeof(one)) != sizeof(one)) {
+            perror("Error message");
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return NULL;
+}
+
+/**
+ * Compress a file into the output buffer of its slot, or with the normal
+ * path if it is too large for the buffers.
+ */
+static void encode_slot(BatchSlot* slot) {
+    if (!slot->direct) {
+        write_mrl_header(slot->output, slot->input_size);
+        slot->output_size = MRL_HEADER_SIZE;
+        if (slot->input_size > 0) {
+            slot->output_size += compress_mrl_block(slot->input, slot->input_size, slot->output + MRL_HEADER_SIZE);
+        }
+        return;
+    }
+
+    MappedFile input;
+    if (!map_input_file(slot->path, &input)) {
+        slot->failed = true;
+        return;
+    }
+    size_t size;
+    char* data = compress_mrl(input.data, input.size, &size);
+    slot->input_size = input.size;
+    unmap_file(&input);
+    if (!data) {
+        printf("Error: could not compress file %s\n", slot->path);
+        slot->failed = true;
+        return;
+    }
+    slot->failed = write_file(slot->out_path, data, size) != 0;
+    slot->output_size = size;
+    free(data);
+}
+
+static void queue_job(Batch* batch, BatchSlot* slot) {
+    slot->state = SLOT_ENCODE;
+    slot->next = NULL;
+    pthread_mutex_lock(&batch->lock);
+    if (batch->jobs) {
+        batch->jobs_tail->next = slot;
+    } else {
+        batch->jobs = slot;
+    }
+    batch->jobs_tail = slot;
+    pthread_cond_signal(&batch->ready);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static BatchSlot* take_done(Batch* batch) {
+    pthread_mutex_lock(&batch->lock);
+    BatchSlot* done = batch->done;
+    batch->done = NULL;
+    pthread_mutex_unlock(&batch->lock);
+    return done;
+}
+
+static void start_slot(Batch* batch, BatchSlot* slot, const char* path) {
+    batch->free = slot->next;
+    batch->active++;
+    slot->path = path;
+    slot->out_path = get_compressed_file_path(path);
+    slot->fd = -1;
+    slot->file_size = 0;
+    slot->input_size = 0;
+    slot->output_size = 0;
+    slot->written = 0;
+    slot->direct = !batch->use_uring;
+    slot->failed = false;
+}
+
+static void finish_slot(Batch* batch, BatchSlot* slot) {
+    if (slot->failed) {
+        batch->failed++;
+    } else {
+        batch->files++;
+        batch->input_bytes += slot->input_size;
+        batch->output_bytes += slot->output_size;
+    }
+    free(slot->out_path);
+    slot->state = SLOT_FREE;
+    slot->next = batch->free;
+    batch->free = slot;
+    batch->active--;
+}
+
+/**
+ * Without io_uring the workers do all the work of a file.
+ */
+static void run_plain(Batch* batch, char** paths, size_t count) {
+    size_t next = 0;
+    while (next < count || batch->active > 0) {
+        while (batch->free && next < count) {
+            BatchSlot* slot = batch->free;
+            start_slot(batch, slot, paths[next++]);
+            queue_job(batch, slot);
+        }
+
+        uint64_t value;
+        if (read(batch->event, &value, sizeof(value)) == -1 && errno != EINTR) {
+            perror("Error message");
+            return;
+        }
+        for (BatchSlot* slot = take_done(batch); slot; ) {
+            BatchSlot* next_slot = slot->next;
+            finish_slot(batch, slot);
+            slot = next_slot;
+        }
+    }
+}
+
+/**
+ * Get a submission queue entry, submitting the prepared ones if the queue
+ * is full.
+ */
+static struct io_uring_sqe* next_sqe(Batch* batch, uint8_t opcode, int fd, uint64_t user_data) {
+    struct io_uring_sqe* sqe = get_uring_sqe(&batch->ring);
+    if (!sqe) {
+        submit_uring(&batch->ring, 0);
+        sqe = get_uring_sqe(&batch->ring);
+    }
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    return sqe;
+}
+
+static void submit_open(Batch* batch, BatchSlot* slot, const char* path, int flags) {
+    struct io_uring_sqe* sqe = next_sqe(batch, IORING_OP_OPENAT, AT_FDCWD, (uint64_t) (uintptr_t) slot);
+    sqe->addr = (uint64_t) (uintptr_t) path;
+    sqe->open_flags = flags | O_CLOEXEC;
+    sqe->len = 0644;
+}
+
+static void submit_read(Batch* batch, BatchSlot* slot) {
+    struct io_uring_sqe* sqe = next_sqe(batch, IORING_OP_READ_FIXED, slot->fd, (uint64_t) (uintptr_t) slot);
+    sqe->addr = (uint64_t) (uintptr_t) (slot->input + slot->input_size);
+    sqe->len = slot->file_size - slot->input_size;
+    sqe->off = slot->input_size;
+    sqe->buf_index = slot->buffer_index;
+    slot->state = SLOT_READ;
+}
+
+static void submit_write(Batch* batch, BatchSlot* slot) {
+    struct io_uring_sqe* sqe = next_sqe(batch, IORING_OP_WRITE_FIXED, slot->fd, (uint64_t) (uintptr_t) slot);
+    sqe->addr = (uint64_t) (uintptr_t) (slot->output + slot->written);
+    sqe->len = slot->output_size - slot->written;
+    sqe->off = slot->written;
+    sqe->buf_index = slot->buffer_index + 1;
+    slot->state = SLOT_WRITE;
+}
+
+static void submit_close(Batch* batch, int fd, uint64_t user_data) {
+    next_sqe(batch, IORING_OP_CLOSE, fd, user_data);
+    batch->closing += user_data == TAG_IGNORE;
+}
+
+static void submit_event_read(Batch* batch) {
+    struct io_uring_sqe* sqe = next_sqe(batch, IORING_OP_READ, batch->event, TAG_EVENT);
+    sqe->addr = (uint64_t) (uintptr_t) &batch->event_value;
+    sqe->len = sizeof(batch->event_value);
+    sqe->off = -1;
+}
+
+/**
+ * Report a failed operation like the plain path does and give up the file.
+ * An output which was already created is removed again.
+ * @param message what failed, e.g. "could not open file"
+ * @param error the error number of the operation
+ */
+static void fail_slot(Batch* batch, BatchSlot* slot, const char* message, int error) {
+    bool output = slot->state >= SLOT_OPEN_OUTPUT;
+    errno = error;
+    print_file_error(message, output ? slot->out_path : slot->path);
+    if (slot->fd != -1) {
+        submit_close(batch, slot->fd, TAG_IGNORE);
+        slot->fd = -1;
+    }
+    if (slot->state == SLOT_WRITE || slot->state == SLOT_CLOSE_OUTPUT) {
+        unlink(slot->out_path);
+    }
+    slot->failed = true;
+    finish_slot(batch, slot);
+}
+
+/**
+ * Close the input and hand the slot to the workers. Files which don't fit
+ * into the buffers are compressed by a worker with the normal path.
+ */
+static void queue_input(Batch* batch, BatchSlot* slot, bool direct) {
+    submit_close(batch, slot->fd, TAG_IGNORE);
+    slot->fd = -1;
+    slot->direct = direct;
+    queue_job(batch, slot);
+}
+/**
+ * Advance a slot after one of its operations completed.
+ */
+static void complete_slot(Batch* batch, BatchSlot* slot, int result) {
+    switch (slot->state) {
+        case SLOT_OPEN_INPUT: {
+            if (result < 0) {
+                fail_slot(batch, slot, "could not open file", -result);
+                return;
+            }
+            slot->fd = result;
+            struct stat st;
+            if (fstat(slot->fd, &st) == -1) {
+                fail_slot(batch, slot, "could not get size of file", errno);
+                return;
+            }
+            if (!S_ISREG(st.st_mode) || st.st_size > BATCH_BUFFER_SIZE) {
+                queue_input(batch, slot, true);
+                return;
+            }
+            slot->file_size = st.st_size;
+            if (slot->file_size == 0) {
+                queue_input(batch, slot, false);
+                return;
+            }
+            submit_read(batch, slot);
+            return;
+        }
+        case SLOT_READ:
+            if (result < 0) {
+                fail_slot(batch, slot, "could not read file", -result);
+                return;
+            }
+            // Short reads are continued, until the size of the file or its end
+            slot->input_size += result;
+            if (result > 0 && slot->input_size < slot->file_size) {
+                submit_read(batch, slot);
+                return;
+            }
+            queue_input(batch, slot, false);
+            return;
+        case SLOT_OPEN_OUTPUT:
+            if (result < 0) {
+                fail_slot(batch, slot, "could not open output file", -result);
+                return;
+            }
+            slot->fd = result;
+            submit_write(batch, slot);
+            return;
+        case SLOT_WRITE:
+            if (result <= 0) {
+                fail_slot(batch, slot, "write failed to file", result < 0 ? -result : EIO);
+                return;
+            }
+            slot->written += result;
+            if (slot->written < slot->output_size) {
+                submit_write(batch, slot);
+                return;
+            }
+            submit_close(batch, slot->fd, (uint64_t) (uintptr_t) slot);
+            slot->fd = -1;
+            slot->state = SLOT_CLOSE_OUTPUT;
+            return;
+        case SLOT_CLOSE_OUTPUT:
+            if (result < 0) {
+                fail_slot(batch, slot, "could not close file", -result);
+                return;
+            }
+            finish_slot(batch, slot);
+            return;
+        default:
+            return;
+    }
+}
+
+/**
+ * The main loop with io_uring: the main thread only submits and completes
+ * I/O, the encoding runs on the workers, which report finished slots through
+ * the eventfd, whose reads complete in the same ring.
+ */
+static void run_uring(Batch* batch, char** paths, size_t count) {
+    size_t next = 0;
+    submit_event_read(batch);
+
+    while (next < count || batch->active > 0) {
+        while (batch->free && next < count) {
+            BatchSlot* slot = batch->free;
+            start_slot(batch, slot, paths[next++]);
+            slot->state = SLOT_OPEN_INPUT;
+            submit_open(batch, slot, slot->path, O_RDONLY);
+        }
+
+        int result = submit_uring(&batch->ring, 1);
+        if (result < 0) {
+            printf("Error: io_uring failed: %s\n", strerror(-result));
+            return;
+        }
+
+        struct io_uring_cqe cqe;
+        bool event = false;
+        while (next_uring_cqe(&batch->ring, &cqe)) {
+            if (cqe.user_data == TAG_EVENT) {
+                event = true;
+            } else if (cqe.user_data == TAG_IGNORE) {
+                batch->closing--;
+            } else {
+                complete_slot(batch, (BatchSlot*) (uintptr_t) cqe.user_data, cqe.res);
+            }
+        }
+
+        for (BatchSlot* slot = take_done(batch); slot; ) {
+            BatchSlot* next_slot = slot->next;
+            if (slot->direct || slot->failed) {
+                finish_slot(batch, slot);
+            } else {
+                slot->state = SLOT_OPEN_OUTPUT;
+                submit_open(batch, slot, slot->out_path, O_WRONLY | O_CREAT | O_TRUNC);
+            }
+            slot = next_slot;
+        }
+        if (event) {
+            submit_event_read(batch);
+        }
+    }
+
+    // The last slots may have queued closes, which must complete before the ring is closed
+    while (batch->closing > 0) {
+        int result = submit_uring(&batch->ring, 1);
+        if (result < 0) {
+            printf("Error: io_uring failed: %s\n", strerror(-result));
+            return;
+        }
+        struct io_uring_cqe cqe;
+        while (next_uring_cqe(&batch->ring, &cqe)) {
+            batch->closing -= cqe.user_data == TAG_IGNORE;
+        }
+    }
+}
+
+/**
+ * Read the list of files, one path per line. Empty lines are skipped.
+ * @param path the list file
+ * @param content will be set to the buffer the paths point into
+ * @param count will be set to the number of paths
+ * @return the paths, or NULL on error
+ */
+static char** read_file_list(const char* path, char** content, size_t* count) {
+    size_t size;
+    char* data = read_file(path, &size);
+    if (!data) {
+        return NULL;
+    }
+    char* grown = realloc(data, size + 1);
+    if (!grown) {
+        printf("Error: could not allocate memory for the list %s\n", path);
+        free(data);
+        return NULL;
+    }
+    data = grown;
+    data[size] = '\n';
+
+    size_t lines = 0;
+    for (size_t i = 0; i <= size; i++) {
+        lines += data[i] == '\n';
+    }
+
+    char** paths = malloc(lines * sizeof(char*));
+    if (!paths) {
+        printf("Error: could not allocate memory for the list %s\n", path);
+        free(data);
+        return NULL;
+    }
+    *count = 0;
+    char* line = data;
+    for (size_t i = 0; i <= size; i++) {
+        if (data[i] != '\n') {
+            continue;
+        }
+        data[i] = '\0';
+        if (i > 0 && data + i > line && data[i - 1] == '\r') {
+            data[i - 1] = '\0';
+        }
+        if (*line) {
+            paths[(*count)++] = line;
+        }
+        line = data + i + 1;
+    }
+
+    *content = data;
+    return paths;
+}
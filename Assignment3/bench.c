@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "./include/rle.h"
+#include "./include/mrl.h"
+
+#define MB (1024.0 * 1024.0)
+
+// Type definitions
+typedef void (*CorpusGenerator)(unsigned char* data, size_t size);
+
+typedef struct {
+    const char* name;
+    CorpusGenerator generate;
+} Corpus;
+
+// Forward declarations
+void generate_sparse(unsigned char* data, size_t size);
+void generate_zeros(unsigned char* data, size_t size);
+void generate_random(unsigned char* data, size_t size);
+void generate_text(unsigned char* data, size_t size);
+void generate_bmp(unsigned char* data, size_t size);
+
+Corpus Corpora[] = {
+        {"sparse", generate_sparse},
+        {"zeros", generate_zeros},
+        {"random", generate_random},
+        {"text", generate_text},
+        {"bmp", generate_bmp}
+};
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t next_random(void) {
+    // xorshift64*, deterministic so every run measures the same data
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double throughput(size_t size, double seconds) {
+    return seconds > 0 ? size / MB / seconds : 0;
+}
+
+/**
+ * A sparse bitmap, about one bit in a thousand is set.
+ */
+void generate_sparse(unsigned char* data, size_t size) {
+    memset(data, 0, size);
+    for (size_t i = 0; i < size / 125; i++) {
+        uint64_t bit = next_random() % (size * 8);
+        data[bit >> 3] |= 0x80 >> (bit & 7);
+    }
+}
+
+void generate_zeros(unsigned char* data, size_t size) {
+    memset(data, 0, size);
+}
+
+void generate_random(unsigned char* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = next_random() >> 56;
+    }
+}
+
+/**
+ * Text made of random words from a small vocabulary, separated by spaces and
+ * newlines.
+ */
+void generate_text(unsigned char* data, size_t size) {
+    const char* words[] = {
+            "the", "process", "memory", "scheduler", "file", "system", "page", "kernel",
+            "thread", "lock", "a", "of", "and", "to", "in", "is", "run", "length", "encoding"
+    };
+    size_t count = sizeof(words) / sizeof(words[0]);
+
+    size_t i = 0;
+    while (i < size) {
+        const char* word = words[next_random() % count];
+        for (size_t j = 0; word[j] && i < size; j++) {
+            data[i++] = word[j];
+        }
+        if (i < size) {
+            data[i++] = next_random() % 12 == 0 ? '\n' : ' ';
+        }
+    }
+}
+
+/**
+ * The pixel data of a 24-bit BMP, like the output of the edge filter of
+ * Assignment2: a black image with a few thin colored lines and filled boxes.
+ * Every row is padded to a multiple of 4 bytes.
+ */
+void generate_bmp(unsigned char* data, size_t size) {
+    memset(data, 0, size);
+
+    size_t width = 1024;
+    size_t row_size = (width * 3 + 3) & ~(size_t) 3;
+    size_t height = size / row_size;
+
+    for (size_t y = 0; y < height; y++) {
+        unsigned char* row = data + y * row_size;
+        for (size_t x = 0; x < width; x++) {
+            unsigned char* pixel = row + x * 3;
+            bool line = (x + y) % 97 == 0 || x % 256 == 0;
+            bool box = (y / 64) % 4 == 1 && (x / 64) % 5 == 2;
+            if (line) {
+                pixel[0] = 255;
+                pixel[1] = (unsigned char) (x ^ y);
+                pixel[2] = 64;
+            } else if (box) {
+                pixel[0] = 40;
+                pixel[1] = 120;
+                pixel[2] = 200;
+            }
+        }
+    }
+}
+
+/**
+ * Run every phase of the codec on the corpus and print one line of results.
+ * Runs in its own process, so the peak RSS is the one of this corpus only.
+ * @return 0 if the round trips reproduce the data
+ */
+int run_corpus(const Corpus* corpus, size_t size) {
+    unsigned char* data = malloc(size);
+    if (!data) {
+        printf("%-8s out of memory", corpus->name);
+        return 1;
+    }
+    corpus->generate(data, size);
+
+    double start = now();
+    size_t compressed_size;
+    char* compressed = compress_mrl((const char*) data, size, &compressed_size);
+    double compress_time = now() - start;
+    if (!compressed) {
+        printf("%-8s could not compress", corpus->name);
+        free(data);
+        return 1;
+    }
+
+    start = now();
+    size_t decompressed_size;
+    char* decompressed = decompress_mrl(compressed, compressed_size, &decompressed_size);
+    double decompress_time = now() - start;
+
+    bool ok = decompressed && decompressed_size == size && memcmp(decompressed, data, size) == 0;
+    free(decompressed);
+    free(compressed);
+
+    // The rle phases last, freeing millions of nodes slows down later mallocs
+    start = now();
+    RLE* rle = create_rle();
+    encode_rle(rle, (const char*) data, size);
+    double encode_time = now() - start;
+
+    start = now();
+    size_t serialized_size;
+    char* serialized = serialize_rle(rle, &serialized_size);
+    double serialize_time = now() - start;
+    delete_rle(rle);
+    if (!serialized) {
+        printf("%-8s could not serialize", corpus->name);
+        free(data);
+        return 1;
+    }
+
+    start = now();
+    RLE* loaded = create_rle();
+    ok = deserialize_rle(loaded, serialized, serialized_size) && ok;
+    double deserialize_time = now() - start;
+
+    start = now();
+    size_t decoded_size;
+    char* decoded = decode_rle(loaded, &decoded_size);
+    double decode_time = now() - start;
+    delete_rle(loaded);
+
+    ok = ok && decoded && decoded_size == size && memcmp(decoded, data, size) == 0;
+    free(decoded);
+    free(serialized);
+    free(data);
+
+    printf("%-8s %9.1f %9.1f %9.1f %9.1f %8.4f %9.1f %9.1f %8.4f",
+           corpus->name,
+           throughput(size, encode_time), throughput(size, serialize_time),
+           throughput(size, deserialize_time), throughput(size, decode_time),
+           (double) serialized_size / size,
+           throughput(size, compress_time), throughput(size, decompress_time),
+           (double) compressed_size / size);
+    fflush(stdout);
+
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2) {
+        printf("Usage: %s [size in MiB]\n", argv[0]);
+        return 1;
+    }
+    size_t size = (size_t) ((argc == 2 ? atof(argv[1]) : 4) * MB);
+    if (size == 0) {
+        printf("Error: invalid size\n");
+        return 1;
+    }
+
+    printf("Corpus size: %.1f MiB, throughput in MB/s of the uncompressed data\n", size / MB);
+    printf("%-8s %9s %9s %9s %9s %8s %9s %9s %8s %10s %s\n",
+           "corpus", "encode", "serialize", "deserial", "decode", "ratio",
+           "compress", "decomp", "mrl", "peak RSS", "check");
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(Corpora) / sizeof(Corpora[0]); i++) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            exit(run_corpus(&Corpora[i], size));
+        } else if (pid < 0) {
+            printf("Fork failed.\n");
+            return 1;
+        }
+
+        int status;
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) == -1) {
+            printf("Wait failed.\n");
+            return 1;
+        }
+
+        bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!WIFEXITED(status)) {
+            printf("%-8s crashed", Corpora[i].name);
+        }
+        printf(" %7.1f MB %s\n", usage.ru_maxrss / 1024.0, ok ? "ok" : "FAIL");
+        failed += !ok;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+#include "./include/file_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Print an error about a file with errno. The lines are printed together, so
+ * errors of several threads don't mix.
+ * @param message what failed, e.g. "could not open file"
+ * @param path the file
+ */
+void print_file_error(const char *message, const char *path) {
+    int error = errno;
+    flockfile(stdout);
+    printf("Error: %s %s\n", message, path);
+    printf("Error number: %d\n", error);
+    printf("Error message: %s\n", strerror(error));
+    funlockfile(stdout);
+}
+
+/**
+ * Read the whole file into a malloc'd buffer. Short reads are retried until
+ * the whole file is read.
+ * @param path the file to read
+ * @param size will be set to the size of the file
+ * @return the content of the file, or NULL on error
+ */
+char* read_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        print_file_error("could not open file", path);
+        return NULL;
+    }
+
+    off_t file_size = get_file_size(fd);
+    if (file_size == -1) {
+        print_file_error("could not get size of file", path);
+        close(fd);
+        return NULL;
+    }
+
+    char* buffer = malloc(file_size ? file_size : 1);
+    if (!buffer) {
+        printf("Error: could not allocate %ld bytes for file %s\n", file_size, path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t bytes_to_read = file_size;
+    size_t total = 0;
+    while (total < bytes_to_read) {
+        ssize_t bytes_read = read(fd, buffer + total, bytes_to_read - total);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            if (bytes_read == -1) {
+                print_file_error("could not read file", path);
+            } else {
+                printf("Error: read file %s incomplete. Expected %ld, got %ld. \n", path, bytes_to_read, total);
+            }
+            free(buffer);
+            close(fd);
+            return NULL;
+        }
+        total += bytes_read;
+    }
+    close(fd);
+
+    *size = bytes_to_read;
+    return buffer;
+}
+
+/**
+ * Write the data to the file, which is created or truncated. Short writes are
+ * retried until all data is written.
+ * @param path the file to write
+ * @param data the data to write
+ * @param size the size of the data
+ * @return 0 on success, 1 on error
+ */
+int write_file(const char *path, const char *data, size_t size) {
+    int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd == -1) {
+        print_file_error("could not open output file", path);
+        return 1;
+    }
+
+    size_t total = 0;
+    while (total < size) {
+        ssize_t bytes_written = write(fd, data + total, size - total);
+        if (bytes_written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_written <= 0) {
+            print_file_error("write failed to file", path);
+            close(fd);
+            unlink(path); // don't leave a partial file behind
+            return 1;
+        }
+        total += bytes_written;
+    }
+    close(fd);
+
+    return 0;
+}
+
+off_t get_file_size(int fd) {
+    struct stat buf;
+    return (fstat(fd, &buf) < 0) ? -1 : buf.st_size;
+}
+
+/**
+ * Map a file read-only into memory. Files which can't be mapped (e.g. empty
+ * files or pipes) are read into a buffer instead.
+ * @param path the file to map
+ * @param file will be set to the mapped file, release it with unmap_file
+ * @return false on error
+ */
+bool map_input_file(const char *path, MappedFile *file) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        print_file_error("could not open file", path);
+        return false;
+    }
+
+    off_t size = get_file_size(fd);
+    void* data = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        file->data = read_file(path, &file->size);
+        file->mapped = false;
+        return file->data != NULL;
+    }
+
+    madvise(data, size, MADV_SEQUENTIAL);
+    file->data = data;
+    file->size = size;
+    file->mapped = true;
+    return true;
+}
+
+/**
+ * Create a file of the given size and map it writable into memory. Changes to
+ * the mapping are written to the file by the page cache. The mapping is
+ * zero-filled, pages which are never written stay holes in the file.
+ * @param path the file to create or truncate
+ * @param size the size of the file
+ * @param file will be set to the mapped file, release it with unmap_file
+ * @return false on error, the file is removed again then
+ */
+bool map_output_file(const char *path, size_t size, MappedFile *file) {
+    int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd == -1) {
+        print_file_error("could not open output file", path);
+        return false;
+    }
+
+    if (ftruncate(fd, size) == -1) {
+        print_file_error("could not resize output file", path);
+        close(fd);
+        unlink(path);
+        return false;
+    }
+
+    // Reserve the blocks now, a full disk would otherwise end in SIGBUS while writing through the mapping
+    if (size > 0) {
+        int error = posix_fallocate(fd, 0, size);
+        if (error != 0) {
+            errno = error;
+            print_file_error("could not allocate output file", path);
+            close(fd);
+            unlink(path);
+            return false;
+        }
+    }
+
+    void* data = NULL;
+    if (size > 0) {
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            print_file_error("could not map output file", path);
+            close(fd);
+            unlink(path);
+            return false;
+        }
+    }
+    close(fd);
+
+    file->data = data;
+    file->size = size;
+    file->mapped = size > 0;
+    return true;
+}
+
+void unmap_file(MappedFile *file) {
+    if (file->mapped) {
+        munmap(file->data, file->size);
+    } else {
+        free(file->data);
+    }
+    file->data = NULL;
+    file->size = 0;
+}
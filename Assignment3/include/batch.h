@@ -0,0 +1,6 @@
+#pragma once
+
+#define BATCH_SLOTS 64                // files in flight at the same time
+#define BATCH_BUFFER_SIZE (256 << 10) // larger files are compressed with the normal path by a worker
+
+int run_batch(const char *list_path);
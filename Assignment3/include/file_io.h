@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// A file in memory, either mapped or read into a malloc'd buffer
+typedef struct {
+    char* data;
+    size_t size;
+    bool mapped;
+} MappedFile;
+
+void print_file_error(const char *message, const char *path);
+
+char* read_file(const char *path, size_t *size);
+int write_file(const char *path, const char *data, size_t size);
+off_t get_file_size(int fd);
+
+bool map_input_file(const char *path, MappedFile *file);
+bool map_output_file(const char *path, size_t size, MappedFile *file);
+void unmap_file(MappedFile *file);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "rle.h"
+
+#define MRL_MAGIC "MRLC"
+#define MRL_HEADER_SIZE 12       // magic (4), decompressed size (8)
+#define MRL_BLOCK_HEADER_SIZE 5  // mode (1), payload size (4)
+#define MRL_BLOCK_SIZE (1 << 20) // every block but the last has this decompressed size
+
+// The way a block is stored, chosen per block by sampling its data
+typedef enum {
+    MRL_MODE_STORED, // the raw bytes
+    MRL_MODE_BITS,   // the serialized rle of the bits (see serialize_rle)
+    MRL_MODE_BYTES,  // runs of repeated bytes (PackBits)
+    MRL_MODE_COUNT   // always keep this as the last element to get the count of modes
+} MRLMode;
+
+// Telemetry of compress_mrl_stats
+typedef struct {
+    RLEStats runs;                    // runs of the bits of all blocks
+    uint64_t blocks[MRL_MODE_COUNT];  // number of blocks per mode
+    uint64_t coded_runs;              // runs in blocks stored as bits
+    uint64_t coded_bytes;             // serialized size of these runs
+    double sample_seconds;
+    double encode_seconds;
+    double serialize_seconds;
+    double stats_seconds;             // collecting the runs, only done for the telemetry
+} MRLStats;
+
+// Reads the blocks of compressed data one after another, see read_mrl_block
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t offset;              // offset of the next block header in data
+    size_t block_size;          // decompressed size of every block but the last
+    size_t decompressed_size;
+    size_t decompressed_offset; // offset of the next block in the decompressed data
+} MRLReader;
+
+char* compress_mrl(const char* data, size_t size, size_t* compressed_size);
+char* compress_mrl_stats(const char* data, size_t size, size_t* compressed_size, MRLStats* stats);
+char* decompress_mrl(const char* data, size_t size, size_t* decompressed_size);
+bool get_mrl_decompressed_size(const char* data, size_t size, size_t* decompressed_size);
+bool check_mrl_blocks(const char* data, size_t size);
+bool decompress_mrl_into(const char* data, size_t size, char* output, size_t output_size);
+
+void write_mrl_header(char* out, size_t decompressed_size);
+size_t compress_mrl_block(const char* data, size_t size, char* out);
+bool init_mrl_reader(MRLReader* reader, const char* data, size_t size);
+bool read_mrl_block(MRLReader* reader, char* output, size_t* block_size);
+
+RLE* load_mrl_rle(const char* data, size_t size);
+char* store_mrl_rle(RLE* rle, size_t* compressed_size);
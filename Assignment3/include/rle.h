@@ -4,15 +4,58 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#define RLE_MAGIC "MRL"
+#define RLE_HEADER_SIZE 12 // magic (3), codec (1), number of counts (8)
+
 typedef struct RLE RLE;
 
+// The codec used for the counts of serialized data, stored in the header
+typedef enum {
+    RLE_CODEC_NIBBLE, // every count as 4/8 bit coded sub-runs of its 64 bits
+    RLE_CODEC_GAMMA,  // every count as Elias-gamma code of count + 1
+    RLE_CODEC_COUNT   // always keep this as the last element to get the count of codecs
+} RLECodec;
+
+// Operations to combine two rles bit by bit
+typedef enum {
+    RLE_AND,
+    RLE_OR,
+    RLE_XOR
+} RLEBitwise;
+
+#define RLE_HISTOGRAM_SIZE 65
+
+// Statistics about the runs of one or more rles
+typedef struct {
+    uint64_t runs;
+    uint64_t bits;
+    uint64_t histogram[RLE_HISTOGRAM_SIZE]; // runs by bit length of the count: 0, 1, 2-3, 4-7, ...
+    uint8_t scan_bit;                       // bit of the run collect_data_stats continues in the next data
+    uint64_t scan_run;                      // length of this run so far
+} RLEStats;
+
 RLE* create_rle();
 void delete_rle(RLE* rle);
 
 void encode_rle(RLE* rle, const char* data, size_t size);
 char* decode_rle(RLE* rle, size_t* size);
+size_t decode_rle_into(RLE* rle, char* output, size_t size);
 
 char* serialize_rle(RLE* rle, size_t* size);
-void deserialize_rle(RLE* rle, const char* data, size_t size);
+char* serialize_rle_codec(RLE* rle, RLECodec codec, size_t* size);
+bool deserialize_rle(RLE* rle, const char* data, size_t size);
+
+uint64_t get_rle_size(RLE* rle);
+uint64_t get_rle_total_count(RLE* rle);
+void append_run_rle(RLE* rle, uint8_t bit, uint64_t count);
+void concat_rle(RLE* rle, RLE* other);
+RLE* split_rle(RLE* rle, uint64_t bits);
+
+RLE* combine_rle(RLE* a, RLE* b, RLEBitwise op);
+uint64_t popcount_rle(RLE* rle);
+
+void collect_rle_stats(RLE* rle, RLEStats* stats);
+void collect_data_stats(const char* data, size_t size, RLEStats* stats);
+void finish_data_stats(RLEStats* stats);
 
 void print_rle(RLE* rle, uint8_t counts_per_line);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// An io_uring instance, set up with the raw system calls
+typedef struct {
+    int fd;
+    // submission queue
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned sq_entries;
+    unsigned to_submit;   // entries prepared since the last submit_uring
+    // completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    // the mappings of the rings
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} Uring;
+
+bool init_uring(Uring* ring, unsigned entries, const uint8_t* ops, size_t op_count);
+void close_uring(Uring* ring);
+bool register_uring_buffers(Uring* ring, const struct iovec* buffers, unsigned count);
+
+struct io_uring_sqe* get_uring_sqe(Uring* ring);
+int submit_uring(Uring* ring, unsigned wait);
+bool next_uring_cqe(Uring* ring, struct io_uring_cqe* cqe);
@@ -4,20 +4,30 @@
 #include <unistd.h>
 #include <malloc.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/stat.h>
-#include "./include/rle.h"
+#include "./include/mrl.h"
+#include "./include/file_io.h"
+#include "./include/batch.h"
 
 
-// Forward declarations
-off_t get_file_size(int fd);
-char* get_compressed_file_path(const char *filePath);
-char* get_decompressed_file_path(const char *filePath);
-
 // Type definitions
-typedef void (*FirstOperation)(RLE* rle, const char* data, size_t size);
-typedef char* (*SecondOperation)(RLE* rle, size_t* size);
+typedef char* (*RunOperation)(const char* data, size_t size, size_t* out_size);
 typedef char* (*FilePathFunction)(const char *);
 
+// Telemetry of a compression or decompression, printed with '-stats'
+typedef struct {
+    bool enabled;
+    MRLStats codec;
+    size_t input_bytes;
+    size_t output_bytes;
+    bool input_mapped;          // the input was mapped, its pages are read while running
+    bool output_mapped;         // the output was mapped, the page cache writes it back later
+    double read_seconds;
+    double run_seconds;
+    double write_seconds;
+} Telemetry;
+
 // The operation enum
 typedef enum {
     COMPRESS,
@@ -25,16 +35,24 @@ typedef enum {
     OPERATION_COUNT // always keep this as the last element to get the count of operations
 } Operation;
 
-// These operations are used to fill up the RLE data structure
-FirstOperation PrepareOutputOperation[OPERATION_COUNT] = {
-        encode_rle,
-        deserialize_rle
-};
+// Names of the bitwise operations, in the order of RLEBitwise
+const char* BitwiseNames[] = {"and", "or", "xor"};
 
-// These operations are used to create the final output data
-SecondOperation FinalizeOutputOperation[OPERATION_COUNT] = {
-        serialize_rle,
-        decode_rle
+// Forward declarations
+int get_bitwise_operation(const char *arg);
+int run_bitwise(int argc, char *argv[]);
+int decompress_to_file(const MappedFile *input, const char *outPath, Telemetry *telemetry);
+void print_telemetry(const Telemetry *telemetry, const char *path, Operation op);
+double now(void);
+RLE* load_rle_file(const char *path);
+char* get_compressed_file_path(const char *filePath);
+char* get_decompressed_file_path(const char *filePath);
+char* get_bitwise_file_path(const char *filePath, const char *name);
+
+// These operations are used to create the output data from the input data
+RunOperation Run[OPERATION_COUNT] = {
+        compress_mrl,
+        decompress_mrl
 };
 
 // These operations are used to create the final output data
@@ -44,82 +62,274 @@ FilePathFunction OutputFilePath[OPERATION_COUNT] = {
 };
 
 int main (int argc, char *argv[] ) {
-    if (argc < 2 || argc > 3) {
+    Telemetry telemetry = {0};
+    if (argc >= 3 && strcmp(argv[argc - 1], "-stats") == 0) {
+        telemetry.enabled = true;
+        argc--;
+    }
+    bool batch = argc == 3 && strcmp(argv[2], "-batch") == 0;
+    bool bitwise = argc >= 3 && (get_bitwise_operation(argv[2]) != -1 || strcmp(argv[2], "-count") == 0);
+    if (telemetry.enabled && (batch || bitwise)) {
+        printf("Error: '-stats' is only supported for compression and decompression\n");
+        return 1;
+    }
+    if (batch) {
+        return run_batch(argv[1]);
+    }
+    if (bitwise) {
+        return run_bitwise(argc, argv);
+    }
+    bool unknown = argc >= 3 && strcmp(argv[2], "-c") != 0 && strcmp(argv[2], "-d") != 0
+        && strcmp(argv[2], "-batch") != 0;
+    if (argc < 2 || argc > 3 || unknown) {
+        if (unknown) {
+            printf("Error: unknown operation %s\n", argv[2]);
+        }
         printf("Usage: %s <filepath> [operation]\n", argv[0]);
         printf("operation: '-d' for decompress, '-c' for compression (default)\n");
+        printf("           '-and', '-or' or '-xor' <filepath> to combine two compressed files\n");
+        printf("           '-count' to count the 1 bits of a compressed file\n");
+        printf("           '-batch' to compress every file listed in <filepath>, one path per line\n");
+        printf("'-stats' as last argument to '-c' or '-d' prints run statistics and phase timings as JSON\n");
         return 1;
     }
     Operation op = (argc == 3) && (strcmp(argv[2], "-d") == 0) ? DECOMPRESS : COMPRESS;
 
     char* path = argv[1];
-    int fd = open(path, O_RDONLY);
-    if (fd == -1) {
-        printf("Error: could not open file %s\n", path);
-        printf("Error number: %d\n", errno);
-        perror("Error message");
+    double start = now();
+    MappedFile input;
+    if (!map_input_file(path, &input)) {
         return 1;
     }
+    telemetry.read_seconds = now() - start;
+    telemetry.input_bytes = input.size;
+    telemetry.input_mapped = input.mapped;
 
-    off_t size = get_file_size(fd);
-    if (size == -1) {
-        printf("Error: could not get file size\n");
-        printf("Error number: %d\n", errno);
-        perror("Error message");
-        return 1;
+    char* outPath = OutputFilePath[op](path);
+    size_t decompressed_size;
+    int status;
+    if (op == DECOMPRESS && strcmp(path, outPath) != 0
+            && get_mrl_decompressed_size(input.data, input.size, &decompressed_size)) {
+        // Decode straight into the page cache of the output file
+        status = decompress_to_file(&input, outPath, &telemetry);
+    } else {
+        size_t bytes_to_write = 0;
+        start = now();
+        char* data = op == COMPRESS && telemetry.enabled
+                ? compress_mrl_stats(input.data, input.size, &bytes_to_write, &telemetry.codec)
+                : Run[op](input.data, input.size, &bytes_to_write);
+        telemetry.run_seconds = now() - start;
+        if (data) {
+            start = now();
+            status = write_file(outPath, data, bytes_to_write);
+            telemetry.write_seconds = now() - start;
+            telemetry.output_bytes = bytes_to_write;
+            free(data);
+        } else {
+            printf("Error: could not %s file %s\n", op == COMPRESS ? "compress" : "decompress", path);
+            status = 1;
+        }
+    }
+    unmap_file(&input);
+    free(outPath);
+    if (status != 0) {
+        return status;
     }
 
-    char* buffer = malloc(size * sizeof(char));
-    size_t bytes_to_read = size;
-    ssize_t bytes_read;
-    if ((bytes_read = read(fd, buffer, size * sizeof(char))) != bytes_to_read) {
-        printf("Error: read file %s incomplete. Expected %ld, got %ld. \n", path, bytes_to_read, bytes_read);
-        if (bytes_read == -1) {
-            printf("Error number: %d\n", errno);
-            perror("Error message");
+    if (telemetry.enabled) {
+        print_telemetry(&telemetry, path, op);
+    } else {
+        printf("Done.\n");
+    }
+
+    return 0;
+}
+
+/**
+ * Look up a bitwise operation by its command line argument, e.g. "-xor".
+ * @param arg the command line argument
+ * @return the RLEBitwise value of the operation, or -1 if it is no bitwise operation
+ */
+int get_bitwise_operation(const char *arg) {
+    for (int i = 0; i < 3; i++) {
+        if (arg[0] == '-' && strcmp(arg + 1, BitwiseNames[i]) == 0) {
+            return i;
         }
-        return 1;
     }
-    close(fd);
+    return -1;
+}
 
-    RLE* rle = create_rle();
-    PrepareOutputOperation[op](rle, buffer, bytes_read);;
-    free(buffer);
+/**
+ * Combine two compressed files bit by bit or count the 1 bits of one, without
+ * decompressing them. The result of a combination is written next to the
+ * first file, e.g. "a-and.mrl".
+ */
+int run_bitwise(int argc, char *argv[]) {
+    int op = get_bitwise_operation(argv[2]);
+    bool count = strcmp(argv[2], "-count") == 0;
+    if ((op == -1 && !count) || (op != -1 && argc != 4) || (count && argc != 3)) {
+        printf("Usage: %s <filepath> -and|-or|-xor <filepath>\n", argv[0]);
+        printf("       %s <filepath> -count\n", argv[0]);
+        return 1;
+    }
 
-    printf("RLE counts:\n");
-    print_rle(rle, 1);
+    RLE* a = load_rle_file(argv[1]);
+    if (!a) {
+        return 1;
+    }
+    if (count) {
+        printf("%lu\n", popcount_rle(a));
+        delete_rle(a);
+        return 0;
+    }
 
-    char* outPath = OutputFilePath[op](path);
-    fd = open(outPath, O_CREAT | O_WRONLY | O_TRUNC, 0644);
-    if (fd == -1) {
-        printf("Error: could not open output file %s\n", outPath);
-        printf("Error number: %d\n", errno);
-        perror("Error message");
+    RLE* b = load_rle_file(argv[3]);
+    if (!b) {
+        delete_rle(a);
         return 1;
     }
 
+    RLE* result = combine_rle(a, b, (RLEBitwise) op);
+    delete_rle(a);
+    delete_rle(b);
+    printf("%lu bits set\n", popcount_rle(result));
+
     size_t bytes_to_write = 0;
-    char* data = FinalizeOutputOperation[op](rle, &bytes_to_write);
-    ssize_t bytes_written;
-    if ((bytes_written = write(fd, data, bytes_to_write)) < ((ssize_t) bytes_to_write)) {
-        printf("Error: write to file %s failed\n", path);
-        if (bytes_written == -1) {
-            printf("Error number: %d\n", errno);
-            perror("Error message");
-        }
+    char* data = store_mrl_rle(result, &bytes_to_write);
+    delete_rle(result);
+    if (!data) {
+        printf("Error: could not compress the result\n");
         return 1;
     }
-    close(fd);
+
+    char* outPath = get_bitwise_file_path(argv[1], BitwiseNames[op]);
+    int status = write_file(outPath, data, bytes_to_write);
+    free(outPath);
     free(data);
-    delete_rle(rle);
+    return status;
+}
 
-    printf("Done.\n");
+/**
+ * Decompress into a writable mapping of the output file, which is sized up
+ * front. This avoids a buffer for the decompressed data and a write of it.
+ * The blocks are checked against the size in the header before the file is
+ * created, and the file is removed again if decompression fails.
+ */
+int decompress_to_file(const MappedFile *input, const char *outPath, Telemetry *telemetry) {
+    size_t size;
+    if (!get_mrl_decompressed_size(input->data, input->size, &size)
+            || !check_mrl_blocks(input->data, input->size)) {
+        printf("Error: could not decompress file, the data is corrupted\n");
+        return 1;
+    }
 
-    return 0;
+    double start = now();
+    MappedFile output;
+    if (!map_output_file(outPath, size, &output)) {
+        return 1;
+    }
+    telemetry->write_seconds = now() - start;
+    telemetry->output_mapped = output.mapped;
+
+    start = now();
+    int status = 0;
+    if (!decompress_mrl_into(input->data, input->size, output.data, output.size)) {
+        printf("Error: could not decompress file, the data is corrupted\n");
+        status = 1;
+    }
+    telemetry->run_seconds = now() - start;
+
+    start = now();
+    unmap_file(&output);
+    telemetry->write_seconds += now() - start;
+    telemetry->output_bytes = size;
+
+    if (status != 0) {
+        unlink(outPath);
+    }
+    return status;
+}
+
+static void print_json_string(const char *value) {
+    putchar('"');
+    for (const char *c = value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            putchar('\\');
+        }
+        putchar(*c);
+    }
+    putchar('"');
+}
+
+/**
+ * Print the telemetry as a single line of JSON. For compression it contains
+ * the modes of the blocks, the number of runs, the mean run length, the
+ * coded bits per run of the blocks stored as bits and a histogram of the run
+ * lengths by their bit length (0, 1, 2-3, 4-7, ...).
+ * A mapped input is timed as "map_input" instead of "read", its pages are
+ * faulted in while encoding or decoding. A mapped output is timed as
+ * "map_output" instead of "write", the page cache writes it back afterwards.
+ */
+void print_telemetry(const Telemetry *telemetry, const char *path, Operation op) {
+    const MRLStats *codec = &telemetry->codec;
+    double total = telemetry->read_seconds + telemetry->run_seconds + telemetry->write_seconds;
+
+    printf("{\"operation\":\"%s\",\"input\":", op == COMPRESS ? "compress" : "decompress");
+    print_json_string(path);
+    printf(",\"input_bytes\":%zu,\"output_bytes\":%zu,\"ratio\":%.6f",
+           telemetry->input_bytes, telemetry->output_bytes,
+           telemetry->input_bytes ? (double) telemetry->output_bytes / telemetry->input_bytes : 0.0);
+
+    if (op == COMPRESS) {
+        const RLEStats *runs = &codec->runs;
+        printf(",\"blocks\":{\"stored\":%lu,\"bits\":%lu,\"bytes\":%lu}",
+               codec->blocks[MRL_MODE_STORED], codec->blocks[MRL_MODE_BITS], codec->blocks[MRL_MODE_BYTES]);
+        printf(",\"runs\":%lu,\"mean_run_bits\":%.3f,\"coded_bits_per_run\":%.3f",
+               runs->runs, runs->runs ? (double) runs->bits / runs->runs : 0.0,
+               codec->coded_runs ? codec->coded_bytes * 8.0 / codec->coded_runs : 0.0);
+
+        int last = RLE_HISTOGRAM_SIZE - 1;
+        while (last > 0 && runs->histogram[last] == 0) {
+            last--;
+        }
+        printf(",\"run_histogram_log2\":[");
+        for (int i = 0; i <= last; i++) {
+            printf(i ? ",%lu" : "%lu", runs->histogram[i]);
+        }
+        printf("]");
+    }
+
+    const char *read_name = telemetry->input_mapped ? "map_input" : "read";
+    const char *write_name = telemetry->output_mapped ? "map_output" : "write";
+    if (op == COMPRESS) {
+        printf(",\"seconds\":{\"%s\":%.6f,\"sample\":%.6f,\"encode\":%.6f,\"serialize\":%.6f,\"stats\":%.6f,\"%s\":%.6f,\"total\":%.6f}}\n",
+               read_name, telemetry->read_seconds, codec->sample_seconds, codec->encode_seconds,
+               codec->serialize_seconds, codec->stats_seconds, write_name, telemetry->write_seconds, total);
+    } else {
+        printf(",\"seconds\":{\"%s\":%.6f,\"decode\":%.6f,\"%s\":%.6f,\"total\":%.6f}}\n",
+               read_name, telemetry->read_seconds, telemetry->run_seconds,
+               write_name, telemetry->write_seconds, total);
+    }
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-off_t get_file_size(int fd) {
-    struct stat buf;
-    return (fstat(fd, &buf) < 0) ? -1 : buf.st_size;
+RLE* load_rle_file(const char *path) {
+    MappedFile input;
+    if (!map_input_file(path, &input)) {
+        return NULL;
+    }
+
+    RLE* rle = load_mrl_rle(input.data, input.size);
+    unmap_file(&input);
+    if (!rle) {
+        printf("Error: file %s is corrupted\n", path);
+    }
+    return rle;
 }
 
 char* get_compressed_file_path(const char *filePath) {
@@ -142,3 +352,12 @@ char* get_decompressed_file_path(const char *filePath) {
     }
     return strdup(filePath); // if no ".mrl", return a copy of original filePath
 }
+
+char* get_bitwise_file_path(const char *filePath, const char *name) {
+    char *dot = strrchr(filePath, '.'); // find last '.'
+    size_t len = dot ? (size_t) (dot - filePath) : strlen(filePath); // if no '.', use whole string
+    char *newPath = (char*) malloc(len + strlen(name) + 6); // 6 for '-', ".mrl" and '\0'
+    strncpy(newPath, filePath, len); // copy the part before '.'
+    sprintf(newPath + len, "-%s.mrl", name); // append "-<name>.mrl"
+    return newPath;
+}
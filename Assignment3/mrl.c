@@ -0,0 +1,641 @@
+#include "./include/mrl.h"
+#include "./include/rle.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLE_SLICES 16
+#define SAMPLE_SLICE_SIZE 4096
+
+static void write_le(unsigned char* data, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        data[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+static uint64_t read_le(const unsigned char* data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t) data[i] << (8 * i);
+    }
+    return value;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t bit_length(uint64_t value) {
+    return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+/**
+ * Pack the data as runs of repeated bytes (PackBits). A control byte n < 128
+ * is followed by n + 1 literal bytes, a control byte n >= 128 is followed by
+ * a single byte which is repeated n - 125 times (3 to 130 times).
+ * @param data the bytes to pack
+ * @param size the number of bytes to pack
+ * @param out output buffer, may be NULL to only compute the packed size
+ * @param limit the maximum size of the packed data
+ * @return the packed size, or SIZE_MAX if it would exceed the limit
+ */
+static size_t pack_bytes(const unsigned char* data, size_t size, unsigned char* out, size_t limit) {
+    size_t i = 0;
+    size_t o = 0;
+
+    while (i < size) {
+        size_t run = 1;
+        while (i + run < size && run < 130 && data[i + run] == data[i]) {
+            run++;
+        }
+
+        if (run >= 3) {
+            if (o + 2 > limit) {
+                return SIZE_MAX;
+            }
+            if (out) {
+                out[o] = (unsigned char) (run + 125);
+                out[o + 1] = data[i];
+            }
+            o += 2;
+            i += run;
+            continue;
+        }
+
+        // Collect literals until the next run of at least 3 bytes starts
+        size_t start = i;
+        size_t length = 0;
+        while (i < size && length < 128) {
+            if (i + 2 < size && data[i] == data[i + 1] && data[i] == data[i + 2]) {
+                break;
+            }
+            i++;
+            length++;
+        }
+
+        if (o + 1 + length > limit) {
+            return SIZE_MAX;
+        }
+        if (out) {
+            out[o] = (unsigned char) (length - 1);
+            memcpy(out + o + 1, data + start, length);
+        }
+        o += 1 + length;
+    }
+
+    return o;
+}
+
+static bool unpack_bytes(const unsigned char* data, size_t size, unsigned char* out, size_t out_size) {
+    size_t i = 0;
+    size_t o = 0;
+
+    while (i < size) {
+        unsigned char control = data[i++];
+        if (control >= 128) {
+            size_t run = control - 125;
+            if (i >= size || o + run > out_size) {
+                return false;
+            }
+            memset(out + o, data[i++], run);
+            o += run;
+        } else {
+            size_t length = control + 1;
+            if (i + length > size || o + length > out_size) {
+                return false;
+            }
+            memcpy(out + o, data + i, length);
+            i += length;
+            o += length;
+        }
+    }
+
+    return o == out_size;
+}
+
+static uint8_t gamma_length(uint64_t count) {
+    return 2 * bit_length(count + 1) - 1;
+}
+
+/**
+ * Compute the number of bits the Elias-gamma coded runs of the data take.
+ * Bytes which continue the current run are counted as a whole.
+ */
+static uint64_t count_gamma_bits(const unsigned char* data, size_t size) {
+    uint64_t bits = 0;
+    uint64_t run = 0;
+    uint8_t counting_bit = data[0] >> 7;
+
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == (counting_bit ? 0xFF : 0x00)) {
+            run += 8;
+            continue;
+        }
+        for (int8_t j = 7; j >= 0; j--) {
+            uint8_t current_bit = (data[i] >> j) & 1;
+            if (current_bit == counting_bit) {
+                run++;
+            } else {
+                bits += gamma_length(run);
+                run = 1;
+                counting_bit ^= 1;
+            }
+        }
+    }
+
+    return bits + gamma_length(run);
+}
+
+/**
+ * Choose the cheapest mode for a block. Instead of encoding the block in every
+ * mode, up to SAMPLE_SLICES slices of the block are sampled and the sizes of
+ * the encodings are estimated from them.
+ * @param data the block
+ * @param size the size of the block
+ * @return the mode with the smallest estimated size
+ */
+static MRLMode choose_mode(const unsigned char* data, size_t size) {
+    if (size == 0) {
+        return MRL_MODE_STORED;
+    }
+
+    size_t slices = size > SAMPLE_SLICES * SAMPLE_SLICE_SIZE ? SAMPLE_SLICES : 1;
+    size_t slice_size = slices > 1 ? SAMPLE_SLICE_SIZE : size;
+    size_t stride = slices > 1 ? (size - slice_size) / (slices - 1) : 0;
+
+    uint64_t gamma_bits = 0;
+    uint64_t packed_size = 0;
+    for (size_t i = 0; i < slices; i++) {
+        const unsigned char* slice = data + i * stride;
+        gamma_bits += count_gamma_bits(slice, slice_size);
+        packed_size += pack_bytes(slice, slice_size, NULL, SIZE_MAX);
+    }
+
+    // Scale the sample up to the whole block
+    uint64_t sampled = (uint64_t) slices * slice_size;
+    uint64_t bits_size = RLE_HEADER_SIZE + (gamma_bits * size / sampled + 7) / 8;
+    uint64_t bytes_size = packed_size * size / sampled;
+
+    MRLMode mode = MRL_MODE_STORED;
+    uint64_t best = size;
+    if (bits_size < best) {
+        mode = MRL_MODE_BITS;
+        best = bits_size;
+    }
+    if (bytes_size < best) {
+        mode = MRL_MODE_BYTES;
+    }
+    return mode;
+}
+
+/**
+ * Compress a single block into out, which must have room for the block header
+ * and size bytes. If the chosen mode turns out not to be smaller than the raw
+ * data, the block is stored.
+ * @param stats telemetry to add to, may be NULL
+ * @return the number of bytes written to out
+ */
+static size_t compress_block(const unsigned char* data, size_t size, unsigned char* out, MRLStats* stats) {
+    unsigned char* payload = out + MRL_BLOCK_HEADER_SIZE;
+    double start = stats ? now() : 0;
+    MRLMode mode = choose_mode(data, size);
+    size_t payload_size = SIZE_MAX;
+    if (stats) {
+        stats->sample_seconds += now() - start;
+    }
+
+    if (mode == MRL_MODE_BITS) {
+        start = stats ? now() : 0;
+        RLE* rle = create_rle();
+        encode_rle(rle, (const char*) data, size);
+        if (stats) {
+            stats->encode_seconds += now() - start;
+            start = now();
+        }
+
+        size_t serialized_size;
+        char* serialized = serialize_rle(rle, &serialized_size);
+        if (serialized && serialized_size < size) {
+            memcpy(payload, serialized, serialized_size);
+            payload_size = serialized_size;
+        }
+        if (stats) {
+            stats->serialize_seconds += now() - start;
+            if (payload_size != SIZE_MAX) {
+                // The block is encoded on its own, so its runs start over with a run of 0s
+                start = now();
+                finish_data_stats(&stats->runs);
+                collect_rle_stats(rle, &stats->runs);
+                stats->stats_seconds += now() - start;
+                stats->coded_runs += get_rle_size(rle);
+                stats->coded_bytes += serialized_size;
+            }
+        }
+        free(serialized);
+        delete_rle(rle);
+    } else if (mode == MRL_MODE_BYTES) {
+        start = stats ? now() : 0;
+        payload_size = pack_bytes(data, size, payload, size - 1);
+        if (stats) {
+            stats->encode_seconds += now() - start;
+        }
+    }
+
+    if (payload_size == SIZE_MAX) {
+        mode = MRL_MODE_STORED;
+        memcpy(payload, data, size);
+        payload_size = size;
+    }
+    if (stats) {
+        stats->blocks[mode]++;
+        if (mode != MRL_MODE_BITS) {
+            start = now();
+            collect_data_stats((const char*) data, size, &stats->runs);
+            stats->stats_seconds += now() - start;
+        }
+    }
+
+    out[0] = (unsigned char) mode;
+    write_le(out + 1, payload_size, 4);
+    return MRL_BLOCK_HEADER_SIZE + payload_size;
+}
+
+/**
+ * Write the container header, for writing the blocks one after another with
+ * compress_mrl_block.
+ * @param out buffer with room for MRL_HEADER_SIZE bytes
+ * @param decompressed_size the size of all blocks together
+ */
+void write_mrl_header(char* out, size_t decompressed_size) {
+    memcpy(out, MRL_MAGIC, 4);
+    write_le((unsigned char*) out + 4, decompressed_size, 8);
+}
+
+/**
+ * Compress a single block, for writing the blocks one after another. Every
+ * block but the last must have MRL_BLOCK_SIZE bytes, or the same size known
+ * to the reader (see init_mrl_reader).
+ * @param data the block
+ * @param size the size of the block
+ * @param out buffer with room for MRL_BLOCK_HEADER_SIZE + size bytes
+ * @return the number of bytes written to out
+ */
+size_t compress_mrl_block(const char* data, size_t size, char* out) {
+    return compress_block((const unsigned char*) data, size, (unsigned char*) out, NULL);
+}
+
+/**
+ * Compress the data into the block container. The data is split into blocks
+ * of MRL_BLOCK_SIZE bytes and every block is stored in the mode which is
+ * estimated to be the smallest: bit-level rle, byte-level rle or the raw
+ * bytes. The compressed data is therefore at most MRL_HEADER_SIZE plus
+ * MRL_BLOCK_HEADER_SIZE per block larger than the data.
+ * @param data Source data, treated as binary data
+ * @param size Size of the source data
+ * @param compressed_size will be set by this function and is the size of the returned data
+ * @return the compressed data
+ */
+char* compress_mrl(const char* data, size_t size, size_t* compressed_size) {
+    return compress_mrl_stats(data, size, compressed_size, NULL);
+}
+
+/**
+ * Compress the data like compress_mrl and collect telemetry: the runs of the
+ * data, the modes of the blocks and the time spent in every phase. The runs
+ * of blocks which are not stored as bits are only counted here, so
+ * compress_mrl doesn't pay for them; the time for this is reported as its
+ * own phase.
+ * @param stats telemetry to add to, may be NULL
+ */
+char* compress_mrl_stats(const char* data, size_t size, size_t* compressed_size, MRLStats* stats) {
+    size_t blocks = (size + MRL_BLOCK_SIZE - 1) / MRL_BLOCK_SIZE;
+    unsigned char* out = malloc(MRL_HEADER_SIZE + blocks * MRL_BLOCK_HEADER_SIZE + size);
+    if (!out) {
+        return NULL;
+    }
+
+    write_mrl_header((char*) out, size);
+
+    size_t o = MRL_HEADER_SIZE;
+    for (size_t i = 0; i < size; i += MRL_BLOCK_SIZE) {
+        size_t block_size = size - i < MRL_BLOCK_SIZE ? size - i : MRL_BLOCK_SIZE;
+        o += compress_block((const unsigned char*) data + i, block_size, out + o, stats);
+    }
+    if (stats) {
+        finish_data_stats(&stats->runs);
+    }
+
+    *compressed_size = o;
+    return (char*) out;
+}
+
+/**
+ * Read the decompressed size from the container header.
+ * @param data the compressed data
+ * @param size the size of the compressed data
+ * @param decompressed_size will be set to the size of the decompressed data
+ * @return false if the data has no container header
+ */
+bool get_mrl_decompressed_size(const char* data, size_t size, size_t* decompressed_size) {
+    if (size < MRL_HEADER_SIZE || memcmp(data, MRL_MAGIC, 4) != 0) {
+        return false;
+    }
+
+    *decompressed_size = read_le((const unsigned char*) data + 4, 8);
+    return true;
+}
+
+/**
+ * Check that the block headers of compressed data add up to the size in its
+ * container header, without decompressing the blocks. Use it before the
+ * output for the decompressed size is created.
+ * @param data the compressed data, with a container header
+ * @param size the size of the compressed data
+ * @return false if the blocks do not match the decompressed size
+ */
+bool check_mrl_blocks(const char* data, size_t size) {
+    size_t raw_size;
+    if (!get_mrl_decompressed_size(data, size, &raw_size)) {
+        return false;
+    }
+
+    const unsigned char* in = (const unsigned char*) data;
+    size_t i = MRL_HEADER_SIZE;
+    for (size_t o = 0; o < raw_size; o += MRL_BLOCK_SIZE) {
+        size_t block_size = raw_size - o < MRL_BLOCK_SIZE ? raw_size - o : MRL_BLOCK_SIZE;
+        if (size - i < MRL_BLOCK_HEADER_SIZE) {
+            return false;
+        }
+
+        MRLMode mode = (MRLMode) in[i];
+        size_t payload_size = read_le(in + i + 1, 4);
+        i += MRL_BLOCK_HEADER_SIZE;
+        if (size - i < payload_size || mode >= MRL_MODE_COUNT
+                || (mode == MRL_MODE_STORED && payload_size != block_size)) {
+            return false;
+        }
+        i += payload_size;
+    }
+    return i == size;
+}
+
+/**
+ * Start reading the blocks of compressed data one after another. The blocks
+ * are expected to have MRL_BLOCK_SIZE bytes, change reader->block_size
+ * afterwards for data written in blocks of another size.
+ * @param reader the reader to initialize
+ * @param data the compressed data, with a container header
+ * @param size the size of the compressed data
+ * @return false if the data has no container header
+ */
+bool init_mrl_reader(MRLReader* reader, const char* data, size_t size) {
+    if (!get_mrl_decompressed_size(data, size, &reader->decompressed_size)) {
+        return false;
+    }
+
+    reader->data = (const unsigned char*) data;
+    reader->size = size;
+    reader->offset = MRL_HEADER_SIZE;
+    reader->block_size = MRL_BLOCK_SIZE;
+    reader->decompressed_offset = 0;
+    return true;
+}
+
+/**
+ * Decompress the next block into a zero-filled output buffer. Runs of 0s in
+ * bit-run blocks are skipped, so pages of the output are not touched by them.
+ * @param reader the reader
+ * @param output zero-filled buffer with room for reader->block_size bytes
+ * @param block_size will be set to the size of the block, 0 after the last block
+ * @return false if the data is corrupted or has bytes after the last block
+ */
+bool read_mrl_block(MRLReader* reader, char* output, size_t* block_size) {
+    size_t remaining = reader->decompressed_size - reader->decompressed_offset;
+    *block_size = remaining < reader->block_size ? remaining : reader->block_size;
+    if (*block_size == 0) {
+        return reader->offset == reader->size;
+    }
+
+    const unsigned char* in = reader->data;
+    size_t i = reader->offset;
+    if (reader->size - i < MRL_BLOCK_HEADER_SIZE) {
+        return false;
+    }
+
+    MRLMode mode = (MRLMode) in[i];
+    size_t payload_size = read_le(in + i + 1, 4);
+    const unsigned char* payload = in + i + MRL_BLOCK_HEADER_SIZE;
+    i += MRL_BLOCK_HEADER_SIZE;
+    if (reader->size - i < payload_size) {
+        return false;
+    }
+
+    bool ok = true;
+    unsigned char* out = (unsigned char*) output;
+    if (mode == MRL_MODE_STORED) {
+        ok = payload_size == *block_size;
+        if (ok) {
+            memcpy(out, payload, *block_size);
+        }
+    } else if (mode == MRL_MODE_BITS) {
+        RLE* rle = create_rle();
+        ok = deserialize_rle(rle, (const char*) payload, payload_size)
+            && get_rle_total_count(rle) == (uint64_t) *block_size * 8;
+        if (ok) {
+            decode_rle_into(rle, output, *block_size);
+        }
+        delete_rle(rle);
+    } else if (mode == MRL_MODE_BYTES) {
+        ok = unpack_bytes(payload, payload_size, out, *block_size);
+    } else {
+        ok = false;
+    }
+
+    reader->offset = i + payload_size;
+    reader->decompressed_offset += *block_size;
+    return ok;
+}
+
+/**
+ * Decompress data created by compress_mrl into a zero-filled buffer, e.g. a
+ * freshly truncated file mapping.
+ * @param data the compressed data, with a container header
+ * @param size the size of the compressed data
+ * @param output zero-filled buffer with the decompressed size (see get_mrl_decompressed_size)
+ * @param output_size the size of the output buffer
+ * @return false if the data is corrupted
+ */
+bool decompress_mrl_into(const char* data, size_t size, char* output, size_t output_size) {
+    MRLReader reader;
+    if (!init_mrl_reader(&reader, data, size) || reader.decompressed_size != output_size) {
+        return false;
+    }
+
+    size_t block_size;
+    do {
+        if (!read_mrl_block(&reader, output + reader.decompressed_offset, &block_size)) {
+            return false;
+        }
+    } while (block_size > 0);
+
+    return true;
+}
+
+/**
+ * Decompress data created by compress_mrl. Data without the container header
+ * is read as a single serialized rle, as written by older versions.
+ * @param data the compressed data
+ * @param size the size of the compressed data
+ * @param decompressed_size will be set by this function and is the size of the returned data
+ * @return the decompressed data, or NULL if the data is corrupted
+ */
+char* decompress_mrl(const char* data, size_t size, size_t* decompressed_size) {
+    size_t raw_size;
+    if (!get_mrl_decompressed_size(data, size, &raw_size)) {
+        RLE* rle = create_rle();
+        char* output = deserialize_rle(rle, data, size) ? decode_rle(rle, decompressed_size) : NULL;
+        delete_rle(rle);
+        return output;
+    }
+
+    char* out = calloc(raw_size ? raw_size : 1, sizeof(char));
+    if (!out) {
+        return NULL;
+    }
+    if (!decompress_mrl_into(data, size, out, raw_size)) {
+        free(out);
+        return NULL;
+    }
+
+    *decompressed_size = raw_size;
+    return out;
+}
+
+/**
+ * Load the bits of compressed data as rle without decompressing them. Blocks
+ * stored as bit runs are appended as they are, only the other blocks are
+ * decoded and encoded again.
+ * @param data the compressed data
+ * @param size the size of the compressed data
+ * @return the rle of the decompressed data, or NULL if the data is corrupted
+ */
+RLE* load_mrl_rle(const char* data, size_t size) {
+    RLE* rle = create_rle();
+    if (size < MRL_HEADER_SIZE || memcmp(data, MRL_MAGIC, 4) != 0) {
+        if (!deserialize_rle(rle, data, size)) {
+            delete_rle(rle);
+            return NULL;
+        }
+        return rle;
+    }
+
+    const unsigned char* in = (const unsigned char*) data;
+    size_t raw_size = read_le(in + 4, 8);
+    unsigned char* buffer = NULL;
+
+    size_t i = MRL_HEADER_SIZE;
+    for (size_t o = 0; o < raw_size; o += MRL_BLOCK_SIZE) {
+        size_t block_size = raw_size - o < MRL_BLOCK_SIZE ? raw_size - o : MRL_BLOCK_SIZE;
+        if (size - i < MRL_BLOCK_HEADER_SIZE) {
+            break;
+        }
+
+        MRLMode mode = (MRLMode) in[i];
+        size_t payload_size = read_le(in + i + 1, 4);
+        const unsigned char* payload = in + i + MRL_BLOCK_HEADER_SIZE;
+        i += MRL_BLOCK_HEADER_SIZE;
+        if (size - i < payload_size) {
+            break;
+        }
+        i += payload_size;
+
+        if (mode == MRL_MODE_BITS) {
+            RLE* block = create_rle();
+            if (!deserialize_rle(block, (const char*) payload, payload_size)
+                    || get_rle_total_count(block) != (uint64_t) block_size * 8) {
+                delete_rle(block);
+                break;
+            }
+            concat_rle(rle, block);
+            delete_rle(block);
+            continue;
+        }
+
+        if (mode == MRL_MODE_STORED && payload_size == block_size) {
+            encode_rle(rle, (const char*) payload, block_size);
+            continue;
+        }
+
+        if (!buffer) {
+            buffer = malloc(MRL_BLOCK_SIZE);
+        }
+        if (mode != MRL_MODE_BYTES || !buffer || !unpack_bytes(payload, payload_size, buffer, block_size)) {
+            break;
+        }
+        encode_rle(rle, (const char*) buffer, block_size);
+    }
+    free(buffer);
+
+    if (i != size || get_rle_total_count(rle) != (uint64_t) raw_size * 8) {
+        delete_rle(rle);
+        return NULL;
+    }
+    return rle;
+}
+
+/**
+ * Compress the bits of an rle without decoding it first. The runs are split
+ * into blocks, blocks whose serialized runs are not smaller than the raw
+ * data are decoded and compressed like in compress_mrl.
+ * @param rle the rle to compress, it is empty afterwards
+ * @param compressed_size will be set by this function and is the size of the returned data
+ * @return the compressed data
+ */
+char* store_mrl_rle(RLE* rle, size_t* compressed_size) {
+    size_t size = (get_rle_total_count(rle) + 7) >> 3;
+    size_t blocks = (size + MRL_BLOCK_SIZE - 1) / MRL_BLOCK_SIZE;
+    unsigned char* out = malloc(MRL_HEADER_SIZE + blocks * MRL_BLOCK_HEADER_SIZE + size);
+    if (!out) {
+        return NULL;
+    }
+
+    memcpy(out, MRL_MAGIC, 4);
+    write_le(out + 4, size, 8);
+
+    size_t o = MRL_HEADER_SIZE;
+    unsigned char* buffer = NULL;
+    for (size_t i = 0; i < size; i += MRL_BLOCK_SIZE) {
+        size_t block_size = size - i < MRL_BLOCK_SIZE ? size - i : MRL_BLOCK_SIZE;
+        RLE* block = split_rle(rle, (uint64_t) block_size * 8);
+
+        size_t serialized_size;
+        char* serialized = serialize_rle(block, &serialized_size);
+        if (serialized && serialized_size < block_size) {
+            out[o] = MRL_MODE_BITS;
+            write_le(out + o + 1, serialized_size, 4);
+            memcpy(out + o + MRL_BLOCK_HEADER_SIZE, serialized, serialized_size);
+            o += MRL_BLOCK_HEADER_SIZE + serialized_size;
+        } else {
+            if (!buffer) {
+                buffer = malloc(MRL_BLOCK_SIZE);
+            }
+            if (!buffer) {
+                free(serialized);
+                delete_rle(block);
+                free(out);
+                return NULL;
+            }
+            memset(buffer, 0, block_size);
+            decode_rle_into(block, (char*) buffer, block_size);
+            o += compress_block(buffer, block_size, out + o, NULL);
+        }
+        free(serialized);
+        delete_rle(block);
+    }
+    free(buffer);
+
+    *compressed_size = o;
+    return (char*) out;
+}
@@ -1,6 +1,10 @@
 #include "./include/rle.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 typedef struct RLENode {
     uint64_t count;
@@ -61,26 +65,21 @@ void delete_rle(RLE* rle) {
     free(rle);
 }
 
-static bool pop_head_rle(RLE* rle, uint64_t* count) {
-    if (!rle->head) {
-        return false;
-    }
-
-    RLENode* node = rle->head;
-    *count = node->count;
-
-    rle->head = node->next;
-    if (rle->tail == node) {
-        rle->tail = NULL;
-    }
-
-    free(node);
-    rle->size -= 1;
-
-    return true;
+/**
+ * Get the number of runs (counts) in the rle.
+ * @param rle the rle
+ * @return the number of runs
+ */
+uint64_t get_rle_size(RLE* rle) {
+    return rle->size;
 }
 
-static uint64_t get_rle_total_count(RLE* rle) {
+/**
+ * Get the number of bits the rle describes, i.e. the sum of all counts.
+ * @param rle the rle
+ * @return the number of bits
+ */
+uint64_t get_rle_total_count(RLE* rle) {
     uint64_t total = 0;
     RLENode* node = rle->head;
     while (node) {
@@ -90,6 +89,53 @@ static uint64_t get_rle_total_count(RLE* rle) {
     return total;
 }
 
+/**
+ * Count the bytes at the start of the data which are equal to fill. The data
+ * is compared 32 (AVX2) or 16 (SSE2) bytes at a time, the first differing
+ * byte is found with movemask and ctz.
+ * @param data the data to scan
+ * @param size the size of the data
+ * @param fill the byte to compare with, 0x00 or 0xFF
+ * @return the number of leading bytes equal to fill
+ */
+static size_t count_fill_bytes(const unsigned char* data, size_t size, unsigned char fill) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    __m256i pattern = _mm256_set1_epi8((char) fill);
+    for (; i + 32 <= size; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) (data + i));
+        uint32_t mask = ~(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, pattern));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i pattern = _mm_set1_epi8((char) fill);
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (data + i));
+        uint32_t mask = ~(uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern)) & 0xFFFF;
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    uint64_t pattern64 = fill ? ~0ULL : 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        if (word != pattern64) {
+            break;
+        }
+    }
+    while (i < size && data[i] == fill) {
+        i++;
+    }
+
+    return i;
+}
+
 /**
  * Fill rle counts with the provided data. The data should be treated as
  * binary data, not as a string, so the data is not null-terminated.
@@ -104,16 +150,30 @@ static uint64_t get_rle_total_count(RLE* rle) {
  *
  * If the start of data is "11110000", then the rle should contain three entries,
  * 0, 4, and 4
+ *
+ * Bytes which continue the current run (0x00 for a run of 0s, 0xFF for a run
+ * of 1s) are skipped with a SIMD scan, bit by bit processing is only done for
+ * the bytes where a run ends.
  * @param rle Will be filled with counts
  * @param data Source data, treated as binary data
  * @param size Size of the source data
  */
 void encode_rle(RLE* rle, const char* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*) data;
     uint8_t counting_bit = (rle->size & 1) ^ 1;
 
     for (size_t i = 0; i < size; i++) {
+        // Whole bytes which continue the current run are skipped in bulk
+        unsigned char fill = counting_bit ? 0xFF : 0x00;
+        if (bytes[i] == fill) {
+            size_t run = count_fill_bytes(bytes + i, size - i, fill);
+            rle->tail->count += (uint64_t) run * 8;
+            i += run - 1;
+            continue;
+        }
+
         for (int8_t j = 7; j >= 0; j--) {
-            uint8_t current_bit = (data[i] >> j) & 1;
+            uint8_t current_bit = (bytes[i] >> j) & 1;
             if (current_bit == counting_bit) {
                 rle->tail->count++;;
             } else {
@@ -124,6 +184,186 @@ void encode_rle(RLE* rle, const char* data, size_t size) {
     }
 }
 
+static void add_run_stats(RLEStats* stats, uint64_t count) {
+    stats->runs++;
+    stats->bits += count;
+    stats->histogram[count ? 64 - __builtin_clzll(count) : 0]++;
+}
+
+/**
+ * Add the runs of the rle to the statistics.
+ * @param rle the rle
+ * @param stats the statistics to add to
+ */
+void collect_rle_stats(RLE* rle, RLEStats* stats) {
+    for (RLENode* node = rle->head; node; node = node->next) {
+        add_run_stats(stats, node->count);
+    }
+}
+
+/**
+ * Add the runs the data would be encoded to by encode_rle to the statistics,
+ * without creating an rle. The last run is kept open in the statistics and
+ * continued by the next call, so data scanned in blocks counts the same runs
+ * as the data scanned at once. Call finish_data_stats after the last block.
+ * @param data Source data, treated as binary data
+ * @param size Size of the source data
+ * @param stats the statistics to add to
+ */
+void collect_data_stats(const char* data, size_t size, RLEStats* stats) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    uint8_t counting_bit = stats->scan_bit;
+    uint64_t run = stats->scan_run;
+
+    for (size_t i = 0; i < size; i++) {
+        unsigned char fill = counting_bit ? 0xFF : 0x00;
+        if (bytes[i] == fill) {
+            size_t fill_bytes = count_fill_bytes(bytes + i, size - i, fill);
+            run += (uint64_t) fill_bytes * 8;
+            i += fill_bytes - 1;
+            continue;
+        }
+
+        for (int8_t j = 7; j >= 0; j--) {
+            uint8_t current_bit = (bytes[i] >> j) & 1;
+            if (current_bit == counting_bit) {
+                run++;
+            } else {
+                add_run_stats(stats, run);
+                run = 1;
+                counting_bit ^= 1;
+            }
+        }
+    }
+    stats->scan_bit = counting_bit;
+    stats->scan_run = run;
+}
+
+/**
+ * Add the run left open by collect_data_stats to the statistics, so the next
+ * scan starts with a new run of 0s like encode_rle does.
+ * @param stats the statistics to add to
+ */
+void finish_data_stats(RLEStats* stats) {
+    if (stats->scan_bit || stats->scan_run) {
+        add_run_stats(stats, stats->scan_run);
+    }
+    stats->scan_bit = 0;
+    stats->scan_run = 0;
+}
+
+/**
+ * Buffered bit writer. Bits are collected MSB first in a 64-bit accumulator
+ * and flushed as whole words, so short runs and codes never touch the output
+ * byte by byte. When writing runs, the output is expected to be zero-filled,
+ * which allows runs of 0s to be skipped instead of written.
+ */
+typedef struct {
+    unsigned char* output;
+    size_t size;
+    size_t byte_index;
+    uint64_t acc;
+    uint8_t acc_bits;
+} BitWriter;
+
+static void flush_bit_writer(BitWriter* writer) {
+    if (writer->acc_bits == 0) {
+        return;
+    }
+
+    uint8_t bytes = (writer->acc_bits + 7) >> 3;
+    if (bytes > writer->size - writer->byte_index) {
+        bytes = writer->size - writer->byte_index;
+    }
+
+    uint64_t acc = writer->acc << (64 - writer->acc_bits);
+    for (uint8_t i = 0; i < bytes; i++) {
+        writer->output[writer->byte_index + i] = acc >> (56 - 8 * i);
+    }
+
+    writer->byte_index += bytes;
+    writer->acc = 0;
+    writer->acc_bits = 0;
+}
+
+static void write_run(BitWriter* writer, uint8_t bit, uint64_t count) {
+    // Fill up the accumulator first, this handles the partial leading byte
+    uint8_t free_bits = 64 - writer->acc_bits;
+    uint64_t take = count < free_bits ? count : free_bits;
+    if (take > 0) {
+        uint64_t bits = bit ? (~0ULL >> (64 - take)) : 0;
+        writer->acc = take == 64 ? bits : (writer->acc << take) | bits;
+        writer->acc_bits += take;
+        count -= take;
+    }
+    if (writer->acc_bits < 64) {
+        return;
+    }
+    flush_bit_writer(writer);
+
+    // The writer is byte aligned now, so the full bytes of the run can be filled at once
+    size_t full_bytes = count >> 3;
+    if (full_bytes > writer->size - writer->byte_index) {
+        full_bytes = writer->size - writer->byte_index;
+    }
+    if (bit) {
+        memset(writer->output + writer->byte_index, 0xFF, full_bytes);
+    }
+    writer->byte_index += full_bytes;
+
+    // The trailing bits stay in the accumulator
+    uint8_t rest = count & 7;
+    writer->acc = bit ? (1ULL << rest) - 1 : 0;
+    writer->acc_bits = rest;
+}
+
+static void write_bits(BitWriter* writer, uint64_t value, uint8_t count) {
+    uint8_t free_bits = 64 - writer->acc_bits;
+    if (count > free_bits) {
+        // Split the value, the upper part completes the accumulator
+        uint8_t rest = count - free_bits;
+        write_bits(writer, value >> rest, free_bits);
+        value &= (1ULL << rest) - 1;
+        count = rest;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    writer->acc = count == 64 ? value : (writer->acc << count) | value;
+    writer->acc_bits += count;
+    if (writer->acc_bits == 64) {
+        flush_bit_writer(writer);
+    }
+}
+
+/**
+ * Decodes the rle into a zero-filled output buffer. Bits beyond the size of
+ * the output are dropped.
+ *
+ * Runs are written with a 64-bit bit writer: short runs are collected in
+ * the accumulator, long runs are filled with memset. The decode speed is
+ * therefore bound by the output size and not by the length of the runs.
+ * @param rle assumed to be filled with counts
+ * @param output zero-filled buffer for the binary data
+ * @param size size of the output buffer
+ * @return the number of bytes written
+ */
+size_t decode_rle_into(RLE* rle, char* output, size_t size) {
+    BitWriter writer = {(unsigned char*) output, size, 0, 0, 0};
+
+    uint8_t bit = 0;
+    RLENode* node = rle->head;
+    while (node && writer.byte_index < size) {
+        write_run(&writer, bit, node->count);
+        bit ^= 1; // Switch between 0 and 1
+        node = node->next;
+    }
+    flush_bit_writer(&writer);
+
+    return writer.byte_index;
+}
+
 /**
  * Decodes the rle to the appropriate binary data. The returned data
  * should be treated as binary data, not as a string, so the data is
@@ -141,25 +381,7 @@ char* decode_rle(RLE* rle, size_t* size) {
         return NULL;
     }
 
-    uint64_t count;
-    size_t byte_index = 0;
-
-    uint8_t bit = 0;
-    uint8_t bit_index = 7;
-
-    while (byte_index < *size && pop_head_rle(rle, &count)) {
-        while (count > 0) {
-            output[byte_index] |= bit << bit_index;
-            if (bit_index == 0) {
-                byte_index++;
-                bit_index = 7;
-            } else {
-                bit_index--;
-            }
-            count--;
-        }
-        bit ^= 1; // Switch between 0 and 1
-    }
+    decode_rle_into(rle, output, *size);
 
     return output;
 }
@@ -182,19 +404,6 @@ void print_rle(RLE* rle, uint8_t counts_per_line) {
     printf("\n");
 }
 
-void printChar(char c) {
-    for (int i = 7; i >= 0; i--) {
-        printf("%d", (c >> i) & 1);
-    }
-    printf("\n");
-}
-void printChar4(char c) {
-    for (int i = 3; i >= 0; i--) {
-        printf("%d", (c >> i) & 1);
-    }
-    printf("\n");
-}
-
 size_t insert_bit_count(char *data, char bit, uint64_t count, size_t i, bool complete) {
     char encoded = bit << 3; // Extend the bit to 4 bits
 
@@ -223,14 +432,8 @@ size_t insert_bit_count(char *data, char bit, uint64_t count, size_t i, bool com
     return i;
 }
 
-char* serialize_rle(RLE *rle, size_t* size) {
+static size_t serialize_rle_nibble(RLE *rle, char *data) {
     RLENode *node = rle->head;
-    *size = rle->size * sizeof(uint64_t);
-
-    char *data = malloc(*size);
-    if (!data) {
-        return NULL;
-    }
 
     size_t i = 0;
     char bitType = 0;
@@ -267,23 +470,12 @@ char* serialize_rle(RLE *rle, size_t* size) {
 
         node = node->next;
     }
-    printf("Bin Data\n");
-    for (int j = 0; j < 10; j++) {
-        printChar(data[j]);
-    }
-
-    return data;
-
+    return i;
 }
 
 
-void deserialize_rle(RLE *rle, const char *data, size_t size) {
-    rle->size = size / sizeof(uint64_t);
-    rle->head = NULL;
-    rle->tail = NULL;
-
+static void deserialize_rle_nibble(RLE *rle, const char *data, size_t size) {
     size_t i = 0;
-    printf("size: %lu\n", size);
 
     bool reading = false;
     bool isExtended = false;
@@ -338,3 +530,416 @@ void deserialize_rle(RLE *rle, const char *data, size_t size) {
         i++;
     }
 }
+
+static uint8_t bit_length(uint64_t value) {
+    return 64 - __builtin_clzll(value);
+}
+
+static size_t serialize_rle_gamma(RLE *rle, char *data, size_t size) {
+    BitWriter writer = {(unsigned char*) data, size, 0, 0, 0};
+
+    RLENode *node = rle->head;
+    while (node) {
+        // Elias-gamma: n zero bits followed by the n + 1 bits of the value
+        uint64_t value = node->count + 1;
+        uint8_t length = bit_length(value);
+        write_bits(&writer, 0, length - 1);
+        write_bits(&writer, value, length);
+        node = node->next;
+    }
+    flush_bit_writer(&writer);
+
+    return writer.byte_index;
+}
+
+/**
+ * Serialize the rle counts with the given codec. The output starts with a
+ * header of RLE_HEADER_SIZE bytes: the magic "MRL", the codec and the number
+ * of counts as a little endian 64-bit integer.
+ * @param rle the counts to serialize
+ * @param codec the codec used for the counts
+ * @param size will be set by this function and is the size of the returned data
+ * @return the serialized data
+ */
+char* serialize_rle_codec(RLE *rle, RLECodec codec, size_t* size) {
+    size_t payload_size;
+    if (codec == RLE_CODEC_GAMMA) {
+        // Size the output exactly, a count needs 2 * bit_length(count + 1) - 1 bits
+        uint64_t bits = 0;
+        for (RLENode *node = rle->head; node; node = node->next) {
+            bits += 2 * bit_length(node->count + 1) - 1;
+        }
+        payload_size = (bits + 7) >> 3;
+    } else {
+        // Worst case: the 64 bits of a count alternate, a nibble for every bit
+        payload_size = rle->size * 64 / 2;
+    }
+
+    char *data = malloc(RLE_HEADER_SIZE + payload_size);
+    if (!data) {
+        return NULL;
+    }
+
+    memcpy(data, RLE_MAGIC, 3);
+    data[3] = (char) codec;
+    for (int i = 0; i < 8; i++) {
+        data[4 + i] = (char) (rle->size >> (8 * i));
+    }
+
+    char *payload = data + RLE_HEADER_SIZE;
+    if (codec == RLE_CODEC_GAMMA) {
+        payload_size = serialize_rle_gamma(rle, payload, payload_size);
+    } else {
+        payload_size = serialize_rle_nibble(rle, payload);
+    }
+
+    *size = RLE_HEADER_SIZE + payload_size;
+    return data;
+}
+
+/**
+ * Serialize the rle counts with the default codec (Elias-gamma).
+ * @param rle the counts to serialize
+ * @param size will be set by this function and is the size of the returned data
+ * @return the serialized data
+ */
+char* serialize_rle(RLE *rle, size_t* size) {
+    return serialize_rle_codec(rle, RLE_CODEC_GAMMA, size);
+}
+
+/**
+ * Buffered bit reader, the counterpart of the BitWriter. The accumulator is
+ * kept left aligned, so the next bits to read are always the top bits.
+ */
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t byte_index;
+    uint64_t acc;
+    uint8_t acc_bits;
+} BitReader;
+
+static void refill_bit_reader(BitReader* reader) {
+    while (reader->acc_bits <= 56 && reader->byte_index < reader->size) {
+        reader->acc |= (uint64_t) reader->data[reader->byte_index++] << (56 - reader->acc_bits);
+        reader->acc_bits += 8;
+    }
+}
+
+static uint64_t read_bits(BitReader* reader, uint8_t count) {
+    if (count > 32) {
+        uint64_t high = read_bits(reader, count - 32);
+        return (high << 32) | read_bits(reader, 32);
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    refill_bit_reader(reader);
+    uint64_t value = reader->acc >> (64 - count);
+    reader->acc <<= count;
+    reader->acc_bits = reader->acc_bits > count ? reader->acc_bits - count : 0;
+    return value;
+}
+
+static uint64_t remaining_bits(BitReader* reader) {
+    return reader->acc_bits + (uint64_t) (reader->size - reader->byte_index) * 8;
+}
+
+/**
+ * Decode table for gamma codes which fit into the next 8 bits (values 1 to 15).
+ * Indexed by the next byte of the stream, a length of 0 marks a longer code.
+ */
+typedef struct {
+    uint8_t length;
+    uint8_t value;
+} GammaTableEntry;
+
+static GammaTableEntry gamma_table[256];
+
+static void init_gamma_table(void) {
+    static bool initialized = false;
+    if (initialized) {
+        return;
+    }
+
+    for (int byte = 1; byte < 256; byte++) {
+        uint8_t zeros = __builtin_clz(byte) - 24;
+        uint8_t length = 2 * zeros + 1;
+        if (length <= 8) {
+            gamma_table[byte].length = length;
+            gamma_table[byte].value = byte >> (8 - length);
+        }
+    }
+    initialized = true;
+}
+
+static bool deserialize_rle_gamma(RLE *rle, const char *data, size_t size, uint64_t count) {
+    init_gamma_table();
+    BitReader reader = {(const unsigned char*) data, size, 0, 0, 0};
+
+    for (uint64_t i = 0; i < count; i++) {
+        refill_bit_reader(&reader);
+
+        GammaTableEntry entry = gamma_table[reader.acc >> 56];
+        if (entry.length > 0 && entry.length <= reader.acc_bits) {
+            read_bits(&reader, entry.length);
+            append_to_rle(rle, entry.value - 1);
+            continue;
+        }
+
+        // Slow path for long codes: count the leading zeros, then read the value
+        uint32_t zeros = 0;
+        while (reader.acc == 0 && reader.acc_bits > 0) {
+            zeros += reader.acc_bits;
+            read_bits(&reader, reader.acc_bits);
+            refill_bit_reader(&reader);
+        }
+        if (reader.acc_bits == 0) {
+            return false; // truncated data
+        }
+        uint8_t leading = __builtin_clzll(reader.acc);
+        read_bits(&reader, leading);
+        zeros += leading;
+
+        if (zeros > 63 || remaining_bits(&reader) < zeros + 1) {
+            return false; // corrupted or truncated data
+        }
+        append_to_rle(rle, read_bits(&reader, zeros + 1) - 1);
+    }
+    return true;
+}
+
+static void clear_rle(RLE *rle) {
+    RLENode *node = rle->head;
+    while (node) {
+        RLENode *next = node->next;
+        free(node);
+        node = next;
+    }
+    rle->head = NULL;
+    rle->tail = NULL;
+    rle->size = 0;
+}
+
+/**
+ * Fill the rle with the counts of serialized data. The codec is taken from
+ * the header, data without a header is read as the original nibble format.
+ * Any counts already in the rle are replaced.
+ * @param rle will be filled with counts
+ * @param data serialized data created by serialize_rle
+ * @param size size of the serialized data
+ * @return false if the header names an unknown codec or the data is truncated
+ */
+bool deserialize_rle(RLE *rle, const char *data, size_t size) {
+    clear_rle(rle);
+
+    if (size < RLE_HEADER_SIZE || memcmp(data, RLE_MAGIC, 3) != 0) {
+        deserialize_rle_nibble(rle, data, size);
+        return true;
+    }
+
+    RLECodec codec = (RLECodec) data[3];
+    uint64_t count = 0;
+    for (int i = 0; i < 8; i++) {
+        count |= (uint64_t) (unsigned char) data[4 + i] << (8 * i);
+    }
+
+    const char *payload = data + RLE_HEADER_SIZE;
+    size_t payload_size = size - RLE_HEADER_SIZE;
+    if (codec == RLE_CODEC_GAMMA) {
+        return deserialize_rle_gamma(rle, payload, payload_size, count);
+    }
+    if (codec == RLE_CODEC_NIBBLE) {
+        deserialize_rle_nibble(rle, payload, payload_size);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Append a run of bits to the rle. If the run has the same bit as the last
+ * run, the last run is extended.
+ * @param rle the rle to append to
+ * @param bit the bit of the run, 0 or 1
+ * @param count the length of the run
+ */
+void append_run_rle(RLE* rle, uint8_t bit, uint64_t count) {
+    if (count == 0) {
+        return;
+    }
+    if (!rle->tail) {
+        if (bit == 1) {
+            append_to_rle(rle, 0); // the first run always counts 0s
+        }
+        append_to_rle(rle, count);
+        return;
+    }
+
+    uint8_t tail_bit = (rle->size & 1) ^ 1;
+    if (bit == tail_bit) {
+        rle->tail->count += count;
+    } else {
+        append_to_rle(rle, count);
+    }
+}
+
+/**
+ * Move all runs of other to the end of the rle. Afterwards other is empty
+ * but still has to be deleted.
+ * @param rle the rle to append to
+ * @param other the rle whose runs are moved
+ */
+void concat_rle(RLE* rle, RLE* other) {
+    if (!other->head) {
+        return;
+    }
+
+    // The first run of other counts 0s, merge it with the last run of 0s
+    uint8_t tail_bit = rle->tail ? (rle->size & 1) ^ 1 : 1;
+    RLENode* first = other->head;
+    if (tail_bit == 0) {
+        rle->tail->count += first->count;
+        other->head = first->next;
+        other->size -= 1;
+        free(first);
+        if (!other->head) {
+            other->tail = NULL;
+            return;
+        }
+    }
+
+    if (rle->tail) {
+        rle->tail->next = other->head;
+    } else {
+        rle->head = other->head;
+    }
+    rle->tail = other->tail;
+    rle->size += other->size;
+
+    other->head = NULL;
+    other->tail = NULL;
+    other->size = 0;
+}
+
+/**
+ * Remove the first bits from the rle and return them as a new rle. The
+ * remaining rle starts with a run of 0s again.
+ * @param rle the rle to split
+ * @param bits the number of bits to remove from the front
+ * @return a new rle with the removed bits
+ */
+RLE* split_rle(RLE* rle, uint64_t bits) {
+    RLE* front = create_rle();
+
+    uint8_t bit = 0;
+    while (bits > 0 && rle->head) {
+        RLENode* node = rle->head;
+        if (node->count > bits) {
+            append_run_rle(front, bit, bits);
+            node->count -= bits;
+            bits = 0;
+            break;
+        }
+
+        append_run_rle(front, bit, node->count);
+        bits -= node->count;
+
+        rle->head = node->next;
+        if (!rle->head) {
+            rle->tail = NULL;
+        }
+        free(node);
+        rle->size -= 1;
+        bit ^= 1;
+    }
+
+    if (bit == 1) {
+        RLENode* node = malloc(sizeof(RLENode));
+        node->count = 0;
+        node->next = rle->head;
+        rle->head = node;
+        if (!rle->tail) {
+            rle->tail = node;
+        }
+        rle->size += 1;
+    }
+
+    return front;
+}
+
+static uint8_t apply_bitwise(RLEBitwise op, uint8_t a, uint8_t b) {
+    switch (op) {
+        case RLE_AND: return a & b;
+        case RLE_OR: return a | b;
+        default: return a ^ b;
+    }
+}
+
+/**
+ * Combine two rles bit by bit without decoding them. Both run lists are
+ * merged: the shorter of the two current runs is taken as a run of the
+ * result, so the cost depends on the number of runs and not on the number
+ * of bits. The shorter rle is treated as if it was padded with 0s.
+ * @param a the first operand
+ * @param b the second operand
+ * @param op the operation to apply to every pair of bits
+ * @return a new rle with the result
+ */
+RLE* combine_rle(RLE* a, RLE* b, RLEBitwise op) {
+    RLE* result = create_rle();
+
+    RLENode* node_a = a->head;
+    RLENode* node_b = b->head;
+    uint64_t left_a = node_a ? node_a->count : 0;
+    uint64_t left_b = node_b ? node_b->count : 0;
+    uint8_t bit_a = 0;
+    uint8_t bit_b = 0;
+
+    while (node_a || node_b) {
+        // Skip exhausted runs
+        if (node_a && left_a == 0) {
+            node_a = node_a->next;
+            left_a = node_a ? node_a->count : 0;
+            bit_a = node_a ? bit_a ^ 1 : 0;
+            continue;
+        }
+        if (node_b && left_b == 0) {
+            node_b = node_b->next;
+            left_b = node_b ? node_b->count : 0;
+            bit_b = node_b ? bit_b ^ 1 : 0;
+            continue;
+        }
+
+        uint64_t count;
+        if (!node_a) {
+            count = left_b;
+        } else if (!node_b) {
+            count = left_a;
+        } else {
+            count = left_a < left_b ? left_a : left_b;
+        }
+
+        append_run_rle(result, apply_bitwise(op, bit_a, bit_b), count);
+        left_a -= node_a ? count : 0;
+        left_b -= node_b ? count : 0;
+    }
+
+    return result;
+}
+
+/**
+ * Count the bits set to 1 without decoding the rle, which is the sum of
+ * every second count.
+ * @param rle the rle
+ * @return the number of 1s
+ */
+uint64_t popcount_rle(RLE* rle) {
+    uint64_t total = 0;
+    uint8_t bit = 0;
+    for (RLENode* node = rle->head; node; node = node->next) {
+        total += bit ? node->count : 0;
+        bit ^= 1;
+    }
+    return total;
+}
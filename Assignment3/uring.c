@@ -0,0 +1,221 @@
+#include "./include/uring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef MRL_IO_URING
+
+static int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Check that the kernel supports all operations, older kernels only know
+ * some of them.
+ */
+static bool probe_ops(int fd, const uint8_t* ops, size_t op_count) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, size);
+    bool supported = io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; supported && i < op_count; i++) {
+        supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+/**
+ * Set up an io_uring and map its rings.
+ * @param ring the ring to set up
+ * @param entries the size of the submission queue, the completion queue has twice the size
+ * @param ops the operations which will be used
+ * @param op_count the number of operations
+ * @return false if io_uring is not available, e.g. on old kernels or if it is disabled
+ */
+bool init_uring(Uring* ring, unsigned entries, const uint8_t* ops, size_t op_count) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(Uring));
+
+    ring->fd = io_uring_setup(entries, &params);
+    if (ring->fd < 0) {
+        return false;
+    }
+    if (!probe_ops(ring->fd, ops, op_count)) {
+        close(ring->fd);
+        return false;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        perror("mmap");
+        close_uring(ring);
+        return false;
+    }
+
+    char* sq = ring->sq_ring;
+    ring->sq_head = (unsigned*) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) (sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+
+    char* cq = ring->cq_ring;
+    ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    return true;
+}
+
+void close_uring(Uring* ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->fd);
+}
+
+/**
+ * Register buffers for IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED, the
+ * kernel then maps them once instead of for every operation.
+ */
+bool register_uring_buffers(Uring* ring, const struct iovec* buffers, unsigned count) {
+    return io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+}
+
+/**
+ * Get the next free submission queue entry, cleared.
+ * @return the entry, or NULL if the submission queue is full
+ */
+struct io_uring_sqe* get_uring_sqe(Uring* ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->to_submit;
+    if (tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->to_submit++;
+    return sqe;
+}
+
+/**
+ * Submit the prepared entries and wait for completions. Entries the kernel
+ * does not take stay in the submission queue and are submitted again by the
+ * next call.
+ * @param ring the ring
+ * @param wait the number of completions to wait for, 0 to only submit
+ * @return the number of submitted entries, or -errno; -EBUSY if the kernel
+ * takes none of the entries
+ */
+int submit_uring(Uring* ring, unsigned wait) {
+    // Publish the entries before the kernel reads the tail
+    unsigned tail = *ring->sq_tail + ring->to_submit;
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    ring->to_submit = 0;
+    unsigned to_submit = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    int submitted = 0;
+    int result;
+    do {
+        result = io_uring_enter(ring->fd, to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (result == 0 && to_submit > 0) {
+            // Nothing was taken, retrying right away would not make progress
+            return -EBUSY;
+        }
+        if (result > 0) {
+            to_submit -= result;
+            submitted += result;
+            wait = to_submit ? wait : 0;
+        }
+    } while ((result >= 0 && to_submit > 0) || (result < 0 && errno == EINTR));
+
+    return result < 0 ? -errno : submitted;
+}
+
+/**
+ * Take the next completion queue entry.
+ * @return false if there is none
+ */
+bool next_uring_cqe(Uring* ring, struct io_uring_cqe* cqe) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    *cqe = ring->cqes[head & *ring->cq_mask];
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#else
+
+// Built without io_uring, the batch mode uses plain system calls
+
+bool init_uring(Uring* ring, unsigned entries, const uint8_t* ops, size_t op_count) {
+    (void) ring;
+    (void) entries;
+    (void) ops;
+    (void) op_count;
+    return false;
+}
+
+void close_uring(Uring* ring) {
+    (void) ring;
+}
+
+bool register_uring_buffers(Uring* ring, const struct iovec* buffers, unsigned count) {
+    (void) ring;
+    (void) buffers;
+    (void) count;
+    return false;
+}
+
+struct io_uring_sqe* get_uring_sqe(Uring* ring) {
+    (void) ring;
+    return NULL;
+}
+
+int submit_uring(Uring* ring, unsigned wait) {
+    (void) ring;
+    (void) wait;
+    return -ENOSYS;
+}
+
+bool next_uring_cqe(Uring* ring, struct io_uring_cqe* cqe) {
+    (void) ring;
+    (void) cqe;
+    return false;
+}
+
+#endif